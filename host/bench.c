@@ -0,0 +1,457 @@
+// Frame-time benchmark for the renderer. Replays scripted camera paths
+// through the map and reports per-frame timings and render counters.
+// usage: bench [passes]
+// Built with PROFILE, also prints the average per-stage breakdown per path.
+// Before timing, the table-based division in fixed.h is checked against exact
+// division; the run fails if it is off by more than 2 + 2^-13 relative.
+// findSector is also checked against testing every sector, and timed, and
+// moveBody is timed with a crowd of bodies wandering around the map.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <math.h>
+#include "render.h"
+#include "map.h"
+#include "sinlut.h"
+#include "profile.h"
+#include "collision.h"
+#include "light.h"
+#include "textures_lz.h"
+#include "texcache.h"
+#include "level_bin.h"
+
+typedef struct {
+    fixed x, y, z;
+    int theta;
+    int sector;     // sector containing the camera until the next keyframe
+    int frames;     // frames to reach the next keyframe
+} Keyframe;
+
+typedef struct {
+    const char * name;
+    const Keyframe * keys;
+    int numKeys;
+    const Sprite * sprites;
+    int numSprites;
+    fixed lodDistance;  // 0 for LOD_DISTANCE
+    int mipBias;        // see setMipBias
+} CameraPath;
+
+#define F(n) ((fixed)((n) * FUNIT))
+
+static const Keyframe spinKeys[] = {
+    {F(0), F(0), 0, 0x0000, 0, 128},
+    {F(0), F(0), 0, 0x10000, 0, 0}
+};
+
+static const Keyframe walkKeys[] = {
+    {F(-2), F(-3),    0, 0x2000, 0, 90},
+    {F(2),  F(3.75),  0, 0x4000, 0, 1},
+    {F(2),  F(4.25),  0, 0x4000, 1, 60},
+    {F(2),  F(6.5),   0, 0x4000, 1, 60},
+    {F(2),  F(6.5),   0, 0xC000, 1, 0}
+};
+
+static const Keyframe portalKeys[] = {
+    {F(1), F(1), 0,      0x4000, 0, 60},
+    {F(3), F(1), F(0.5), 0x4000, 0, 60},
+    {F(1), F(1), 0,      0x4000, 0, 0}
+};
+
+static const Keyframe closeupKeys[] = {
+    {F(3),   F(0),  0, 0x0000, 0, 60},
+    {F(3.9), F(-2), 0, 0x1000, 0, 0}
+};
+
+// along the textured wall at x = 4, nearly touching it, so it's seen edge on
+// from end to end and the near end is clipped right at the camera
+static const Keyframe grazeKeys[] = {
+    {F(3.99), F(-3.9), 0, 0x4000, 0, 90},
+    {F(3.99), F(3.5),  0, 0x4200, 0, 30},
+    {F(3.99), F(3.5),  0, 0xC000, 0, 0}
+};
+
+// the walk, past sprites on both sides of the portal
+static const Sprite walkSprites[] = {
+    {F(-1),   F(-2),   F(-1), F(1),   F(1.5), 0, 0},
+    {F(2.5),  F(-1),   F(-1), F(0.5), F(1),   0, 1},
+    {F(1),    F(1.5),  F(-1), F(0.5), F(0.5), 0, 2},
+    {F(3),    F(2.5),  F(-1), F(1),   F(1),   0, 1},
+    {F(1.5),  F(3.5),  F(-1), F(0.5), F(1.5), 0, 0},
+    {F(1),    F(5.5),  F(-1), F(1),   F(1),   1, 2},
+    {F(3),    F(6),    F(-1), F(0.5), F(1),   1, 0},
+    {F(2),    F(6.75), F(-1), F(0.5), F(0.5), 1, 1}
+};
+
+#define PATH(name, keys) {name, keys, sizeof(keys) / sizeof(keys[0]), 0, 0, 0, 0}
+#define SPRITE_PATH(name, keys, sprites) {name, keys, sizeof(keys) / sizeof(keys[0]), \
+    sprites, sizeof(sprites) / sizeof(sprites[0]), 0, 0}
+// the map is too small for LOD_DISTANCE, so bring it in close
+#define LOD_PATH(name, keys, distance) {name, keys, sizeof(keys) / sizeof(keys[0]), \
+    0, 0, distance, 0}
+// nor are its walls ever far enough to draw from mips, so bias them
+#define MIP_PATH(name, keys, bias) {name, keys, sizeof(keys) / sizeof(keys[0]), \
+    0, 0, 0, bias}
+static const CameraPath paths[] = {
+    PATH("spin", spinKeys),
+    PATH("walk", walkKeys),
+    PATH("portal", portalKeys),
+    PATH("closeup", closeupKeys),
+    SPRITE_PATH("sprites", walkKeys, walkSprites),
+    LOD_PATH("lod", spinKeys, F(3)),
+    MIP_PATH("mips", walkKeys, 3),
+    PATH("graze", grazeKeys)
+};
+#define NUM_PATHS (sizeof(paths) / sizeof(paths[0]))
+
+static int pathFrames(const CameraPath * path) {
+    int frames = 1; // final keyframe
+    for (int i = 0; i < path->numKeys - 1; i++)
+        frames += path->keys[i].frames;
+    return frames;
+}
+
+// camera for frame n of a path
+static const Sector * pathCamera(const CameraPath * path, int n, int * theta) {
+    for (int i = 0; i < path->numKeys - 1; i++) {
+        const Keyframe * a = path->keys + i, * b = a + 1;
+        if (n < a->frames) {
+            camX = a->x + (b->x - a->x) * n / a->frames;
+            camY = a->y + (b->y - a->y) * n / a->frames;
+            camZ = a->z + (b->z - a->z) * n / a->frames;
+            *theta = a->theta + (b->theta - a->theta) * n / a->frames;
+            return &map.sectors[a->sector];
+        }
+        n -= a->frames;
+    }
+    const Keyframe * last = path->keys + path->numKeys - 1;
+    camX = last->x; camY = last->y; camZ = last->z;
+    *theta = last->theta;
+    return &map.sectors[last->sector];
+}
+
+#ifdef PROFILE
+static void addProfile(ProfileFrame * sum, const ProfileFrame * frame) {
+    sum->total += frame->total;
+    for (int i = 0; i < PROF_NUM_STAGES; i++) {
+        sum->stages[i] += frame->stages[i];
+        sum->calls[i] += frame->calls[i];
+    }
+    for (int i = 0; i < PROFILE_MAX_DEPTH; i++)
+        sum->depths[i] += frame->depths[i];
+}
+
+static void printProfile(const ProfileFrame * sum, int frames) {
+    for (int i = 0; i < PROF_NUM_STAGES; i++) {
+        if (sum->calls[i] == 0)
+            continue;
+        printf("    %-8s %9.2f us/f %5.1f%% %7.1f calls/f\n", profileStageNames[i],
+            sum->stages[i] / 1000.0 / frames, 100.0 * sum->stages[i] / sum->total,
+            (double)sum->calls[i] / frames);
+    }
+    for (int i = 0; i < PROFILE_MAX_DEPTH; i++) {
+        if (sum->depths[i] == 0)
+            continue;
+        printf("    depth %d  %9.2f us/f %5.1f%%\n", i + 1,
+            sum->depths[i] / 1000.0 / frames, 100.0 * sum->depths[i] / sum->total);
+    }
+}
+#endif
+
+// worst error of a fast division result, in units of the allowed error
+static double divError(double result, double exact, double * worst) {
+    double err = fabs(result - exact) / (2 + fabs(exact) / 8192);
+    if (err > *worst)
+        *worst = err;
+    return err;
+}
+
+static int checkDivision(void) {
+    double recipWorst = 0, divWorst = 0;
+    for (fixed a = 1; a < (1 << 24); a += 1 + a / 512) {
+        divError(FRECIP_FAST(a), (double)FUNIT2 / a, &recipWorst);
+        divError(FRECIP_FAST(-a), -(double)FUNIT2 / a, &recipWorst);
+        for (fixed b = 1; b < (1 << 24); b += 1 + b / 64) {
+            if ((double)a * FUNIT / b >= 0x7FFFFFFF)
+                continue; // doesn't fit in a fixed
+            divError(FDIV_FAST(a, b), (double)a * FUNIT / b, &divWorst);
+            divError(FDIV_FAST(-a, b), -(double)a * FUNIT / b, &divWorst);
+            divError(FDIV_FAST(a, -b), -(double)a * FUNIT / b, &divWorst);
+        }
+    }
+    printf("division: FRECIP_FAST error %.3f, FDIV_FAST error %.3f (limit 1)\n",
+        recipWorst, divWorst);
+    return recipWorst <= 1 && divWorst <= 1;
+}
+
+static long long nanoTime(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+#define LOOKUP_POINTS 4096
+
+// random points over the map's bounds, some outside every sector
+static int checkSectorLookup(void) {
+    static fixed xs[LOOKUP_POINTS], ys[LOOKUP_POINTS];
+    fixed minX = 0, minY = 0, maxX = 0, maxY = 0;
+    for (int v = 0; v < map.numVertices; v++) {
+        minX = v == 0 || map.vertexX[v] < minX ? map.vertexX[v] : minX;
+        maxX = v == 0 || map.vertexX[v] > maxX ? map.vertexX[v] : maxX;
+        minY = v == 0 || map.vertexY[v] < minY ? map.vertexY[v] : minY;
+        maxY = v == 0 || map.vertexY[v] > maxY ? map.vertexY[v] : maxY;
+    }
+    srand(1);
+    for (int i = 0; i < LOOKUP_POINTS; i++) {
+        xs[i] = minX - FUNIT + rand() % (maxX - minX + 2 * FUNIT);
+        ys[i] = minY - FUNIT + rand() % (maxY - minY + 2 * FUNIT);
+    }
+    int bad = 0;
+    for (int i = 0; i < LOOKUP_POINTS; i++) {
+        int found = findSector(xs[i], ys[i], -1), inside = 0;
+        for (int s = 0; s < map.numSectors; s++)
+            inside |= pointInSector(s, xs[i], ys[i]);
+        if (found < 0 ? inside : !pointInSector(found, xs[i], ys[i]))
+            bad++;
+    }
+    // cold lookups go through the grid, hinted ones mostly don't
+    int hint = 0;
+    long long start = nanoTime();
+    for (int i = 0; i < LOOKUP_POINTS; i++)
+        findSector(xs[i], ys[i], -1);
+    long long cold = nanoTime() - start;
+    start = nanoTime();
+    for (int i = 0; i < LOOKUP_POINTS; i++) {
+        int s = findSector(xs[i], ys[i], hint);
+        hint = s >= 0 ? s : hint;
+    }
+    long long hinted = nanoTime() - start;
+    printf("findSector: %.1f ns cold, %.1f ns hinted, %d wrong\n",
+        (double)cold / LOOKUP_POINTS, (double)hinted / LOOKUP_POINTS, bad);
+    return bad == 0;
+}
+
+// FNV-1a over the visible page, to catch changes in rendered output
+static u32 frameHash(u32 hash) {
+    const u8 * bytes = (const u8 *)MODE4_FB;
+    for (int i = 0; i < M4WIDTH * SCREEN_HEIGHT * 2; i++)
+        hash = (hash ^ bytes[i]) * 16777619u;
+    return hash;
+}
+
+#define CROWD_SIZE 64
+#define CROWD_TICKS 600
+
+// distance from a body to the nearest solid wall, minus its radius
+static double wallClearance(const Body * body) {
+    double best = 1e9;
+    for (int s = 0; s < map.numSectors; s++) {
+        const Sector * sec = map.sectors + s;
+        for (int i = 0; i < sec->numWalls; i++) {
+            int w = sec->firstWall + i, prev = sec->firstWall + (i + sec->numWalls - 1) % sec->numWalls;
+            if (map.wallPortal[w] != NO_PORTAL)
+                continue;
+            double ax = map.vertexX[map.wallVertex[prev]], ay = map.vertexY[map.wallVertex[prev]];
+            double ex = map.vertexX[map.wallVertex[w]] - ax, ey = map.vertexY[map.wallVertex[w]] - ay;
+            double t = ((body->x - ax) * ex + (body->y - ay) * ey) / (ex * ex + ey * ey);
+            t = t < 0 ? 0 : t > 1 ? 1 : t;
+            double dist = hypot(body->x - ax - t * ex, body->y - ay - t * ey);
+            best = dist < best ? dist : best;
+        }
+    }
+    return (best - body->radius) / FUNIT;
+}
+
+// Bodies walking in straight lines, turning at random. Fails if any ends up
+// outside its sector or in a wall.
+static int checkCollision(void) {
+    static Body crowd[CROWD_SIZE];
+    static int heading[CROWD_SIZE];
+    srand(2);
+    for (int i = 0; i < CROWD_SIZE; i++) {
+        crowd[i] = (Body){.radius = FUNIT/4, .height = FUNIT*3/2, .sector = -1};
+        // start spread over the first sector
+        const Sector * sec = map.sectors;
+        int v1 = map.wallVertex[sec->firstWall], v2 = map.wallVertex[sec->firstWall + 2];
+        placeBody(&crowd[i], (map.vertexX[v1] + map.vertexX[v2]) / 2 + rand() % FUNIT - FUNIT/2,
+            (map.vertexY[v1] + map.vertexY[v2]) / 2 + rand() % FUNIT - FUNIT/2);
+        heading[i] = rand() & 0xFFFF;
+    }
+    int bad = 0;
+    long long start = nanoTime();
+    for (int tick = 0; tick < CROWD_TICKS; tick++) {
+        for (int i = 0; i < CROWD_SIZE; i++) {
+            if ((rand() & 31) == 0)
+                heading[i] = rand() & 0xFFFF;
+            moveBody(&crowd[i], (lu_cos(heading[i]) >> 4) / 8, (lu_sin(heading[i]) >> 4) / 8);
+        }
+    }
+    long long time = nanoTime() - start;
+    for (int i = 0; i < CROWD_SIZE; i++) {
+        bad += crowd[i].sector < 0 || !pointInSector(crowd[i].sector, crowd[i].x, crowd[i].y)
+            || wallClearance(&crowd[i]) < -1.0 / 64;
+    }
+    printf("moveBody: %d bodies, %.2f us/tick, %d lost\n", CROWD_SIZE,
+        time / 1000.0 / CROWD_TICKS, bad);
+    return bad == 0;
+}
+
+#ifdef COLUMN_DEPTH
+// Look from the first sector at the step down from its ceiling into the second
+// (4 units ahead, with its far wall at 7), and ask about points either side.
+static int checkColumnDepth(void) {
+    static const struct {
+        fixed x, y;
+        int inFront;
+    } points[] = {
+        {F(2), F(3), 1},
+        {F(2), F(5), 0},    // behind the step, in the second sector
+        {F(2), F(8), 0},    // outside the map
+        {F(-4), F(0), 0}    // behind the camera
+    };
+    camX = F(2);
+    camY = F(0);
+    camZ = 0;
+    drawFrame(&map.sectors[0], lu_sin(0x4000) >> 4, lu_cos(0x4000) >> 4);
+    fixed distance = wallDistance(M4WIDTH / 2);
+    int bad = ABS(distance - F(4)) > F(4) / 32;
+    // the answers are for the frame drawn, wherever the camera has gone since
+    for (int moved = 0; moved < 2; moved++) {
+        camY = moved ? F(4) : F(0);
+        for (int i = 0; i < sizeof(points) / sizeof(points[0]); i++)
+            bad += inFrontOfWall(points[i].x, points[i].y) != points[i].inFront;
+    }
+    printf("column depth: step %.3f units away (4 exact), %d wrong\n",
+        (double)distance / FUNIT, bad);
+    return bad == 0;
+}
+#endif
+
+int main(int argc, char ** argv) {
+    int passes = argc > 1 ? atoi(argv[1]) : 100;
+    if (passes < 1)
+        passes = 1;
+
+    if (!checkDivision())
+        return 1;
+
+    if (!loadMap(level_bin)) {
+        fprintf(stderr, "bad map\n");
+        return 1;
+    }
+    printf("map: %d vertices, %d walls, %d sectors, %d bytes in IWRAM\n",
+        map.numVertices, map.numWalls, map.numSectors, map.iwramUsed);
+    if (!checkSectorLookup() || !checkCollision())
+        return 1;
+    long long start = nanoTime();
+    initLighting(texturesPal, texturesPalLen/2);
+    printf("light: %d levels, color maps built in %.1f ms\n", LIGHT_LEVELS,
+        (nanoTime() - start) / 1e6);
+    if (!initTextureCache()) {
+        fprintf(stderr, "textures don't fit in the cache\n");
+        return 1;
+    }
+    printf("textures: %d bytes unpacked from %d\n", texturesBitmapLen, texturesLzLen);
+    initRenderer();
+#ifdef COLUMN_DEPTH
+    if (!checkColumnDepth())
+        return 1;
+#endif
+
+#ifdef SCRATCH_BUFFER
+    printf("frame: drawn column-major to a scratch buffer, then copied\n");
+#else
+    printf("frame: drawn to the page\n");
+#endif
+    printf("%-8s %6s %9s %9s %9s %9s %7s %7s %7s %5s  %s\n", "path", "frames",
+        "avg_us", "min_us", "max_us", "pixels/f", "walls/f", "verts/f", "sects/f",
+        "ycb", "hash");
+    long long totalTime = 0;
+    int totalFrames = 0;
+    for (int p = 0; p < NUM_PATHS; p++) {
+        const CameraPath * path = paths + p;
+        int frames = pathFrames(path);
+        long long sum = 0, min = -1, max = 0;
+        long long pixels = 0, walls = 0, verts = 0, sects = 0;
+        int ycbPeak = 0, portalsDropped = 0, pvsCulled = 0, sprites = 0, promoted = 0;
+        int lodWalls = 0, wallsSkipped = 0, windowsClosed = 0, mipColumns = 0;
+        u32 hash = 2166136261u;
+#ifdef PROFILE
+        ProfileFrame profileSum = {0};
+#endif
+        setSprites(path->sprites, path->numSprites);
+        setLodDistance(path->lodDistance ? path->lodDistance : LOD_DISTANCE);
+        setMipBias(path->mipBias);
+        for (int pass = 0; pass < passes; pass++) {
+            for (int n = 0; n < frames; n++) {
+                int theta;
+                const Sector * sector = pathCamera(path, n, &theta);
+                fixed sint = lu_sin(theta) >> 4;
+                fixed cost = lu_cos(theta) >> 4;
+
+                renderStats = (RenderStats){0};
+                long long start = nanoTime();
+                drawFrame(sector, sint, cost);
+                long long t = nanoTime() - start;
+
+                sum += t;
+                if (min < 0 || t < min)
+                    min = t;
+                if (t > max)
+                    max = t;
+                if (pass == 0) {
+                    pixels += renderStats.pixels;
+                    walls += renderStats.walls;
+                    verts += renderStats.vertices;
+                    sects += renderStats.sectors;
+                    if (renderStats.ycbPeak > ycbPeak)
+                        ycbPeak = renderStats.ycbPeak;
+                    portalsDropped += renderStats.portalsDropped;
+                    pvsCulled += renderStats.pvsCulled;
+                    sprites += renderStats.sprites;
+                    promoted += renderStats.texturesPromoted;
+                    lodWalls += renderStats.lodWalls;
+                    wallsSkipped += renderStats.wallsSkipped;
+                    windowsClosed += renderStats.windowsClosed;
+                    mipColumns += renderStats.mipColumns;
+                    hash = frameHash(hash);
+                }
+#ifdef PROFILE
+                addProfile(&profileSum, profileLastFrame());
+#endif
+            }
+        }
+        int count = frames * passes;
+        printf("%-8s %6d %9.2f %9.2f %9.2f %9lld %7.1f %7.1f %7.1f %5d  %08x\n",
+            path->name, frames, sum / 1000.0 / count, min / 1000.0, max / 1000.0,
+            pixels / frames, (double)walls / frames, (double)verts / frames,
+            (double)sects / frames, ycbPeak, hash);
+        if (portalsDropped)
+            printf("  %d portals dropped\n", portalsDropped);
+        if (pvsCulled)
+            printf("  %d portals outside the PVS\n", pvsCulled);
+        if (sprites)
+            printf("  %.1f sprites/f\n", (double)sprites / frames);
+        if (promoted)
+            printf("  %d textures moved into IWRAM\n", promoted);
+        if (lodWalls)
+            printf("  %.1f walls/f drawn flat\n", (double)lodWalls / frames);
+        if (mipColumns)
+            printf("  %.1f columns/f drawn from mips\n", (double)mipColumns / frames);
+        if (wallsSkipped)
+            printf("  %.1f walls/f skipped, their window already covered\n",
+                (double)wallsSkipped / frames);
+        if (windowsClosed)
+            printf("  %d portals closed off\n", windowsClosed);
+#ifdef PROFILE
+        printProfile(&profileSum, count);
+#endif
+        totalTime += sum;
+        totalFrames += count;
+    }
+    printf("total: %d frames, %.2f us/frame\n", totalFrames,
+        totalTime / 1000.0 / totalFrames);
+    return 0;
+}
@@ -0,0 +1,47 @@
+// Host stand-ins for the GBA hardware used by the renderer
+
+#include <string.h>
+#include "platform.h"
+
+u16 hostVram[0xC000];
+
+// Same semantics as the BIOS call: mode is a word count in the low 21 bits,
+// bit 24 selects fill (copy the first source word to every destination word).
+void CpuFastSet(const void * source, void * dest, u32 mode) {
+    u32 count = mode & 0x1FFFFF;
+    const u32 * src = source;
+    u32 * dst = dest;
+    if (mode & (1<<24)) {
+        u32 fill = *src;
+        for (u32 i = 0; i < count; i++)
+            dst[i] = fill;
+    } else {
+        memcpy(dst, src, count * 4);
+    }
+}
+
+// BIOS LZ77 format: a header word with 0x10 in the low byte and the unpacked
+// size above it, then groups of a flag byte and 8 blocks, each a literal byte
+// (flag bit clear) or a 16 bit back reference (3 + top 4 bits bytes long,
+// 1 + low 12 bits back), top flag bit first.
+void LZ77UnCompWram(const void * source, void * dest) {
+    const u8 * src = source;
+    u8 * dst = dest;
+    u32 size = (src[1] | (src[2] << 8) | (src[3] << 16));
+    u8 * end = dst + size;
+    src += 4;
+    while (dst < end) {
+        int flags = *src++;
+        for (int i = 0; i < 8 && dst < end; i++, flags <<= 1) {
+            if (flags & 0x80) {
+                int length = (src[0] >> 4) + 3;
+                int distance = (((src[0] & 0xF) << 8) | src[1]) + 1;
+                src += 2;
+                for (; length > 0 && dst < end; length--, dst++)
+                    *dst = dst[-distance];
+            } else {
+                *dst++ = *src++;
+            }
+        }
+    }
+}
@@ -0,0 +1,162 @@
+#include "collision.h"
+
+// Times along a move are fractions in 16 bits, products of two fixeds have
+// 16 fraction bits as well. Everything is done in 64 bits, walls can be long.
+#define T_ONE (1 << 16)
+// fixed units a slide moves away from the wall it's against
+#define SLIDE_PUSH 2
+
+// a wall hit by a move
+typedef struct {
+    s32 t;          // T_ONE is the whole move
+    s32 nx, ny;     // unit normal pointing back at the body, T_ONE long
+} Hit;
+
+static u32 sqrt64(u64 n) {
+    u64 root = 0;
+    for (u64 bit = 1ull << 62; bit; bit >>= 2) {
+        if (n >= root + bit) {
+            n -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+    }
+    return root;
+}
+
+// whether a body can't pass through a wall, a portal with too high a step or
+// too little room
+static int wallBlocks(const Body * body, int wall) {
+    int portal = map.wallPortal[wall];
+    if (portal == NO_PORTAL)
+        return 1;
+    const Sector * next = map.sectors + portal;
+    fixed floor = next->zmin > body->z ? next->zmin : body->z;
+    return next->zmin - body->z > STEP_HEIGHT || next->zmax - floor < body->height;
+}
+
+// Sweep a circle at (px, py) along (dx, dy) against point (ax, ay). Keep the
+// hit if it's earlier than hit->t.
+static void sweepPoint(fixed px, fixed py, fixed dx, fixed dy, fixed radius,
+        fixed ax, fixed ay, Hit * hit) {
+    fixed qx = px - ax, qy = py - ay;
+    // too far to reach, also keeps the products below small
+    if (ABS(qx) + ABS(qy) > radius * 2 + ABS(dx) + ABS(dy))
+        return;
+    s64 a = (s64)dx * dx + (s64)dy * dy;
+    s64 b = (s64)qx * dx + (s64)qy * dy;
+    s64 c = (s64)qx * qx + (s64)qy * qy - (s64)radius * radius;
+    if (b >= 0 || a == 0)
+        return; // moving away
+    s32 t;
+    if (c <= 0) {
+        t = 0; // already touching
+    } else {
+        s64 disc = b * b - a * c;
+        if (disc < 0)
+            return;
+        // |q + t*d| == radius, first root
+        t = ((-b - (s64)sqrt64(disc)) << 16) / a;
+        if (t < 0)
+            t = 0;
+    }
+    if (t >= hit->t)
+        return;
+    fixed cx = qx + (((s64)dx * t) >> 16), cy = qy + (((s64)dy * t) >> 16);
+    fixed length = sqrt64((s64)cx * cx + (s64)cy * cy);
+    if (length == 0)
+        return;
+    hit->t = t;
+    hit->nx = ((s64)cx << 16) / length;
+    hit->ny = ((s64)cy << 16) / length;
+}
+
+// Sweep a circle against the wall from (ax, ay) to (bx, by).
+static void sweepWall(fixed px, fixed py, fixed dx, fixed dy, fixed radius,
+        fixed ax, fixed ay, fixed bx, fixed by, Hit * hit) {
+    fixed ex = bx - ax, ey = by - ay;
+    fixed length = sqrt64((s64)ex * ex + (s64)ey * ey);
+    if (length == 0)
+        return;
+    // distance from the wall's line and speed towards its left side
+    fixed dist = ((s64)ex * (py - ay) - (s64)ey * (px - ax)) / length;
+    s64 cross = (s64)ex * dy - (s64)ey * dx;
+    int side = dist >= 0 ? 1 : -1;
+    // the sign from the full product, a slow approach rounds to zero speed
+    if ((cross < 0 ? -1 : cross > 0) != -side)
+        return;
+    fixed gap = dist * side - radius, approach = -(cross / length) * side;
+    if (gap > approach)
+        return; // doesn't reach the line this move
+    s32 t = gap > 0 ? ((s64)gap << 16) / approach : 0;
+    if (t >= hit->t)
+        return;
+    // where along the wall the circle touches the line
+    fixed along = ((s64)ex * (px - ax) + (s64)ey * (py - ay)) / length;
+    along += ((((s64)ex * dx + (s64)ey * dy) / length) * t) >> 16;
+    if (along < 0) {
+        sweepPoint(px, py, dx, dy, radius, ax, ay, hit);
+    } else if (along > length) {
+        sweepPoint(px, py, dx, dy, radius, bx, by, hit);
+    } else {
+        hit->t = t;
+        hit->nx = -(((s64)ey << 16) / length) * side;
+        hit->ny = (((s64)ex << 16) / length) * side;
+    }
+}
+
+// sweep against the blocking walls of a sector
+static void sweepSector(const Body * body, int sector, fixed dx, fixed dy, Hit * hit) {
+    const Sector * sec = map.sectors + sector;
+    int last = sec->firstWall + sec->numWalls - 1;
+    fixed ax = map.vertexX[map.wallVertex[last]], ay = map.vertexY[map.wallVertex[last]];
+    for (int w = sec->firstWall; w <= last; w++) {
+        fixed bx = map.vertexX[map.wallVertex[w]], by = map.vertexY[map.wallVertex[w]];
+        if (wallBlocks(body, w))
+            sweepWall(body->x, body->y, dx, dy, body->radius, ax, ay, bx, by, hit);
+        ax = bx;
+        ay = by;
+    }
+}
+
+int placeBody(Body * body, fixed x, fixed y) {
+    int sector = findSector(x, y, body->sector);
+    if (sector < 0)
+        return 0;
+    body->x = x;
+    body->y = y;
+    body->sector = sector;
+    body->z = map.sectors[sector].zmin;
+    return 1;
+}
+
+void moveBody(Body * body, fixed moveX, fixed moveY) {
+    for (int i = 0; i < COLLIDE_ITERATIONS && (moveX || moveY); i++) {
+        // the walls of the sector and its neighbours, which is as far as a
+        // body can get in one move
+        Hit hit = {T_ONE, 0, 0};
+        const Sector * sec = map.sectors + body->sector;
+        sweepSector(body, body->sector, moveX, moveY, &hit);
+        for (int w = sec->firstWall; w < sec->firstWall + sec->numWalls; w++) {
+            if (map.wallPortal[w] != NO_PORTAL)
+                sweepSector(body, map.wallPortal[w], moveX, moveY, &hit);
+        }
+
+        fixed stepX = ((s64)moveX * hit.t) >> 16, stepY = ((s64)moveY * hit.t) >> 16;
+        if (!placeBody(body, body->x + stepX, body->y + stepY))
+            return;
+        if (hit.t == T_ONE)
+            return;
+        // slide: the rest of the move without the part into the wall, and
+        // a little away from it so rounding never leaves it creeping in
+        moveX -= stepX;
+        moveY -= stepY;
+        s64 into = ((s64)moveX * hit.nx + (s64)moveY * hit.ny) >> 16;
+        if (into < SLIDE_PUSH) {
+            into -= SLIDE_PUSH;
+            moveX -= (into * hit.nx) >> 16;
+            moveY -= (into * hit.ny) >> 16;
+        }
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef COLLISION_H
+#define COLLISION_H
+
+#include "platform.h"
+#include "fixed.h"
+#include "map.h"
+
+// Movement of upright cylinders through the map. A move is swept against the
+// walls of the body's sector and its neighbours, sliding along whatever it
+// hits, and the body is kept standing on the floor of the sector it ends up in.
+
+// highest floor a body can step up onto
+#define STEP_HEIGHT     (FUNIT/2)
+// walls hit and slid along per move at most
+#define COLLIDE_ITERATIONS 3
+
+typedef struct {
+    fixed x, y;
+    fixed z;        // feet, the floor of sector
+    fixed radius;
+    fixed height;
+    int sector;
+} Body;
+
+// put a body at (x, y) on the floor of the sector there
+// return 0 (and leave it alone) if that's outside the map
+int placeBody(Body * body, fixed x, fixed y);
+// move a body by (moveX, moveY), as far as the walls let it
+void moveBody(Body * body, fixed moveX, fixed moveY);
+
+#endif
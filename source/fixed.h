@@ -22,6 +22,56 @@ static inline fixed FRECIP(fixed a) {
     return FUNIT2 / a;
 }
 
+// Division-free FRECIP and FDIV. The divisor is normalized to [1, 2), its
+// reciprocal is interpolated from recip_lut and the result shifted back.
+// About 15 bits of precision; the divisor must not be zero.
+
+extern const unsigned short recip_lut[257];
+
+// reciprocal of the mantissa of a (a > 0) in 15 fixeds, and a's top bit
+static inline int32_t recipMantissa(uint32_t a, int * msb) {
+    int p = 31 - __builtin_clz(a);
+    uint32_t m = p >= 16 ? a >> (p - 16) : a << (16 - p); // [2^16, 2^17)
+    int i = (m >> 8) & 0xFF, frac = m & 0xFF;
+    *msb = p;
+    return recip_lut[i] - (((recip_lut[i] - recip_lut[i+1]) * frac) >> 8);
+}
+
+static inline fixed FRECIP_FAST(fixed a) {
+    int p;
+    int32_t r = recipMantissa(a < 0 ? -a : a, &p);
+    // FUNIT2 / a == r * 2^(1-p)
+    fixed result = p >= 1 ? r >> (p - 1) : r << 1;
+    return a < 0 ? -result : result;
+}
+
+static inline fixed FDIV_FAST(fixed a, fixed b) {
+    int p;
+    int32_t r = recipMantissa(b < 0 ? -b : b, &p);
+    // a * FUNIT / b == a * r * 2^(FPOINT-15-p)
+    fixed result = ((int64_t)a * r) >> (15 - FPOINT + p);
+    return b < 0 ? -result : result;
+}
+
+// integer square root of a fixed point value
+static inline fixed FSQRT(fixed a) {
+    // sqrt(a / FUNIT) * FUNIT == sqrt(a * FUNIT)
+    uint32_t n = (uint32_t)a << FPOINT, root = 0;
+    for (uint32_t bit = 1u << 30; bit; bit >>= 2) {
+        if (n >= root + bit) {
+            n -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+    }
+    return root;
+}
+
+static inline fixed cross(fixed x1, fixed y1, fixed x2, fixed y2) {
+    return FMULT(x1, y2) - FMULT(y1, x2);
+}
+
 static inline int ABS(int a) {
     // https://stackoverflow.com/a/21854586
     return (a + (a >> 31)) ^ (a >> 31);
@@ -0,0 +1,40 @@
+#include "gameloop.h"
+
+LoopStats loopStats;
+
+static volatile u32 vblankCount;
+static u32 lastTick;
+// for fps
+static u32 secondStart, secondFrames;
+
+static void vblankHandler(void) {
+    vblankCount++;
+}
+
+void initGameLoop(void) {
+    irqSet(IRQ_VBLANK, vblankHandler);
+    irqEnable(IRQ_VBLANK);
+    loopStats = (LoopStats){0};
+    lastTick = secondStart = vblankCount;
+    secondFrames = 0;
+}
+
+int gameLoopTicks(void) {
+    u32 now = vblankCount;
+    int ticks = now - lastTick;
+    lastTick = now;
+    if (ticks > MAX_CATCHUP_TICKS) {
+        loopStats.droppedTicks += ticks - MAX_CATCHUP_TICKS;
+        ticks = MAX_CATCHUP_TICKS;
+    }
+    loopStats.ticks += ticks;
+
+    loopStats.frames++;
+    secondFrames++;
+    if (now - secondStart >= 60) {
+        loopStats.fps = secondFrames * 60 / (now - secondStart);
+        secondStart = now;
+        secondFrames = 0;
+    }
+    return ticks;
+}
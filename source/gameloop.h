@@ -0,0 +1,28 @@
+#ifndef GAMELOOP_H
+#define GAMELOOP_H
+
+#include "platform.h"
+
+// Fixed timestep scheduling. The game is simulated in 60 Hz ticks, one per
+// VBlank, however long frames take to draw: after each frame, run the ticks
+// that gameLoopTicks() returns.
+
+// most ticks run after one frame, the rest are dropped so a very slow frame
+// doesn't stall the game catching up
+#define MAX_CATCHUP_TICKS 4
+
+typedef struct {
+    int fps;            // frames drawn in the last second
+    u32 frames;         // frames drawn since initGameLoop
+    u32 ticks;          // ticks run
+    u32 droppedTicks;   // ticks skipped, over MAX_CATCHUP_TICKS
+} LoopStats;
+
+extern LoopStats loopStats;
+
+// installs the VBlank handler, call after irqInit
+void initGameLoop(void);
+// call once per frame drawn, returns the number of ticks to run
+int gameLoopTicks(void);
+
+#endif
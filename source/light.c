@@ -0,0 +1,55 @@
+#include "light.h"
+
+EWRAM_BSS u16 colorMaps[LIGHT_LEVELS][PALETTE_COLORS];
+// only read when loading it, leave IWRAM to the renderer
+EWRAM_BSS u16 lightPalette[PALETTE_COLORS];
+
+#define RED(c)      ((c) & 31)
+#define GREEN(c)    (((c) >> 5) & 31)
+#define BLUE(c)     (((c) >> 10) & 31)
+#define RGB(r, g, b) ((r) | ((g) << 5) | ((b) << 10))
+
+static int scaleColor(int color, int num, int den) {
+    return RGB(RED(color) * num / den, GREEN(color) * num / den, BLUE(color) * num / den);
+}
+
+static int closestColor(int color, int colors) {
+    int best = 0, bestDist = 0x7FFFFFFF;
+    for (int i = 0; i < colors; i++) {
+        int dr = RED(color) - RED(lightPalette[i]);
+        int dg = GREEN(color) - GREEN(lightPalette[i]);
+        int db = BLUE(color) - BLUE(lightPalette[i]);
+        int dist = dr * dr + dg * dg + db * db;
+        if (dist < bestDist) {
+            best = i;
+            bestDist = dist;
+        }
+    }
+    return best;
+}
+
+int averageColor(int a, int b, int c, int d) {
+    int ca = lightPalette[a], cb = lightPalette[b], cc = lightPalette[c], cd = lightPalette[d];
+    int color = RGB((RED(ca) + RED(cb) + RED(cc) + RED(cd) + 2) / 4,
+        (GREEN(ca) + GREEN(cb) + GREEN(cc) + GREEN(cd) + 2) / 4,
+        (BLUE(ca) + BLUE(cb) + BLUE(cc) + BLUE(cd) + 2) / 4);
+    return closestColor(color, PALETTE_COLORS / 2);
+}
+
+void initLighting(const u16 * palette, int colors) {
+    const int half = PALETTE_COLORS / 2;
+    for (int i = 0; i < half; i++) {
+        lightPalette[i] = i < colors ? palette[i] : 0;
+        lightPalette[i + half] = scaleColor(lightPalette[i], 1, 2);
+    }
+    for (int level = 0; level < LIGHT_LEVELS; level++) {
+        for (int i = 0; i < PALETTE_COLORS; i++) {
+            int index = i;
+            // full light, and the half brightness copies, stay as they are
+            if (level < LIGHT_LEVELS - 1 && i < half)
+                index = closestColor(scaleColor(lightPalette[i], level + 1, LIGHT_LEVELS),
+                    PALETTE_COLORS);
+            colorMaps[level][i] = index | (index << 8);
+        }
+    }
+}
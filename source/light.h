@@ -0,0 +1,28 @@
+#ifndef LIGHT_H
+#define LIGHT_H
+
+#include "platform.h"
+#include "map.h"
+
+// Shading by light level. Each level has a color map from a palette index to
+// the Mode 4 hword (doubled index) of the closest color at that brightness,
+// so shading a texel or a column of solid color is one lookup. The upper half
+// of the palette is filled with the lower half at half brightness, for the
+// darker levels to map into.
+
+#define LIGHT_LEVELS    (MAX_LIGHT + 1)
+#define PALETTE_COLORS  256
+
+// indexed by level, darkest first, then palette index
+extern u16 colorMaps[LIGHT_LEVELS][PALETTE_COLORS];
+// palette to load, built from the one given to initLighting
+extern u16 lightPalette[PALETTE_COLORS];
+
+// Build the palette and color maps from up to 128 colors. This searches the
+// palette for every color at every level, so do it once at startup.
+void initLighting(const u16 * palette, int colors);
+// index of the full brightness color closest to the average of four palette
+// indices, for shrinking textures. Call after initLighting.
+int averageColor(int a, int b, int c, int d);
+
+#endif
@@ -0,0 +1,196 @@
+#include <string.h>
+#include "map.h"
+
+Map map;
+
+// .bss is in IWRAM on the GBA
+static u32 iwramPool[MAP_IWRAM_SIZE / 4];
+
+// Uniform grid over the map for findSector: each cell lists the sectors whose
+// bounding box overlaps it
+typedef struct {
+    fixed x, y;         // bottom left corner
+    int shift;          // log2 of cell size in fixed units
+    int width, height;  // in cells
+    u16 cellStart[GRID_MAX_CELLS + 1];  // into sectors
+    u8 sectors[GRID_MAX_ENTRIES];
+} SectorGrid;
+
+EWRAM_BSS static SectorGrid grid;
+
+void * allocMapIwram(u32 size) {
+    size = (size + 3) & ~3;
+    if (map.iwramUsed + size > MAP_IWRAM_SIZE)
+        return 0;
+    void * dest = (u8 *)iwramPool + map.iwramUsed;
+    map.iwramUsed += size;
+    return dest;
+}
+
+// copy an array from the map into the IWRAM pool, or leave it in ROM if it
+// doesn't fit
+static const void * placeArray(const u8 * base, u32 offset, u32 size) {
+    void * dest = allocMapIwram(size);
+    if (!dest)
+        return base + offset;
+    memcpy(dest, base + offset, size);
+    return dest;
+}
+
+static void sectorBounds(int sector, fixed * minX, fixed * minY, fixed * maxX, fixed * maxY) {
+    const Sector * sec = map.sectors + sector;
+    *minX = *minY = 0x7FFFFFFF;
+    *maxX = *maxY = -0x7FFFFFFF;
+    for (int w = sec->firstWall; w < sec->firstWall + sec->numWalls; w++) {
+        fixed x = map.vertexX[map.wallVertex[w]], y = map.vertexY[map.wallVertex[w]];
+        *minX = x < *minX ? x : *minX;
+        *maxX = x > *maxX ? x : *maxX;
+        *minY = y < *minY ? y : *minY;
+        *maxY = y > *maxY ? y : *maxY;
+    }
+}
+
+// cells overlapped by a sector's bounding box
+static void sectorCells(int sector, int * cx1, int * cy1, int * cx2, int * cy2) {
+    fixed minX, minY, maxX, maxY;
+    sectorBounds(sector, &minX, &minY, &maxX, &maxY);
+    *cx1 = (minX - grid.x) >> grid.shift;
+    *cy1 = (minY - grid.y) >> grid.shift;
+    *cx2 = (maxX - grid.x) >> grid.shift;
+    *cy2 = (maxY - grid.y) >> grid.shift;
+}
+
+// fill the cell lists at the current size, return 0 if they don't fit
+static int fillGrid(void) {
+    int cells = grid.width * grid.height;
+    // count each cell's sectors into the cell after it, then sum to starts
+    memset(grid.cellStart, 0, sizeof(grid.cellStart));
+    int entries = 0;
+    for (int s = 0; s < map.numSectors; s++) {
+        int cx1, cy1, cx2, cy2;
+        sectorCells(s, &cx1, &cy1, &cx2, &cy2);
+        entries += (cx2 - cx1 + 1) * (cy2 - cy1 + 1);
+        if (entries > GRID_MAX_ENTRIES)
+            return 0;
+        for (int cy = cy1; cy <= cy2; cy++) {
+            for (int cx = cx1; cx <= cx2; cx++)
+                grid.cellStart[cy * grid.width + cx + 1]++;
+        }
+    }
+    for (int c = 0; c < cells; c++)
+        grid.cellStart[c + 1] += grid.cellStart[c];
+    // fill, using the starts as cursors and shifting them back after
+    for (int s = 0; s < map.numSectors; s++) {
+        int cx1, cy1, cx2, cy2;
+        sectorCells(s, &cx1, &cy1, &cx2, &cy2);
+        for (int cy = cy1; cy <= cy2; cy++) {
+            for (int cx = cx1; cx <= cx2; cx++)
+                grid.sectors[grid.cellStart[cy * grid.width + cx]++] = s;
+        }
+    }
+    for (int c = cells; c > 0; c--)
+        grid.cellStart[c] = grid.cellStart[c - 1];
+    grid.cellStart[0] = 0;
+    return 1;
+}
+
+static int buildGrid(void) {
+    fixed minX = 0x7FFFFFFF, minY = 0x7FFFFFFF, maxX = -0x7FFFFFFF, maxY = -0x7FFFFFFF;
+    for (int v = 0; v < map.numVertices; v++) {
+        minX = map.vertexX[v] < minX ? map.vertexX[v] : minX;
+        maxX = map.vertexX[v] > maxX ? map.vertexX[v] : maxX;
+        minY = map.vertexY[v] < minY ? map.vertexY[v] : minY;
+        maxY = map.vertexY[v] > maxY ? map.vertexY[v] : maxY;
+    }
+    grid.x = minX;
+    grid.y = minY;
+    // the smallest cells that fit, coarser grids have fewer overlaps
+    for (grid.shift = GRID_MIN_CELL_SHIFT; grid.shift < 30; grid.shift++) {
+        grid.width = ((maxX - minX) >> grid.shift) + 1;
+        grid.height = ((maxY - minY) >> grid.shift) + 1;
+        if (grid.width * grid.height <= GRID_MAX_CELLS && fillGrid())
+            return 1;
+    }
+    return 0;
+}
+
+int pointInSector(int sector, fixed x, fixed y) {
+    const Sector * sec = map.sectors + sector;
+    int last = sec->firstWall + sec->numWalls - 1;
+    fixed x1 = map.vertexX[map.wallVertex[last]], y1 = map.vertexY[map.wallVertex[last]];
+    for (int w = sec->firstWall; w <= last; w++) {
+        fixed x2 = map.vertexX[map.wallVertex[w]], y2 = map.vertexY[map.wallVertex[w]];
+        // walls go counterclockwise, so the inside is on their left
+        if ((s64)(x2 - x1) * (y - y1) - (s64)(y2 - y1) * (x - x1) < 0)
+            return 0;
+        x1 = x2;
+        y1 = y2;
+    }
+    return 1;
+}
+
+int findSector(fixed x, fixed y, int hint) {
+    if (hint >= 0) {
+        if (pointInSector(hint, x, y))
+            return hint;
+        // most moves stay in or next to the last sector
+        const Sector * sec = map.sectors + hint;
+        for (int w = sec->firstWall; w < sec->firstWall + sec->numWalls; w++) {
+            int portal = map.wallPortal[w];
+            if (portal != NO_PORTAL && pointInSector(portal, x, y))
+                return portal;
+        }
+    }
+    int cx = (x - grid.x) >> grid.shift, cy = (y - grid.y) >> grid.shift;
+    if (x < grid.x || y < grid.y || cx >= grid.width || cy >= grid.height)
+        return -1;
+    int cell = cy * grid.width + cx;
+    for (int i = grid.cellStart[cell]; i < grid.cellStart[cell + 1]; i++) {
+        if (pointInSector(grid.sectors[i], x, y))
+            return grid.sectors[i];
+    }
+    return -1;
+}
+
+int loadMap(const void * data) {
+    const MapHeader * header = data;
+    const u8 * base = data;
+    if (header->magic != MAP_MAGIC || header->version != MAP_VERSION)
+        return 0;
+    if (header->numVertices > MAX_VERTICES || header->numWalls > MAX_WALLS
+            || header->numSectors > MAX_SECTORS)
+        return 0;
+
+    map.numVertices = header->numVertices;
+    map.numWalls = header->numWalls;
+    map.numSectors = header->numSectors;
+    map.iwramUsed = 0;
+    // in order of how often drawSector reads them
+    int vertexSize = map.numVertices * sizeof(fixed);
+    int wallSize = map.numWalls * sizeof(u16);
+    map.vertexX = placeArray(base, header->vertexX, vertexSize);
+    map.vertexY = placeArray(base, header->vertexY, vertexSize);
+    map.wallVertex = placeArray(base, header->wallVertex, wallSize);
+    map.wallPortal = placeArray(base, header->wallPortal, wallSize);
+    map.sectors = placeArray(base, header->sectors, map.numSectors * sizeof(Sector));
+    map.wallFillType = placeArray(base, header->wallFillType, map.numWalls);
+    map.wallFillNum = placeArray(base, header->wallFillNum, wallSize);
+    // only read when the player changes sector
+    map.pvsIndex = (const u16 *)(base + header->pvsIndex);
+    map.pvsData = base + header->pvsData;
+    return buildGrid();
+}
+
+void decodePVS(int sector, u8 * out) {
+    const u8 * in = map.pvsData + map.pvsIndex[sector];
+    u8 * end = out + PVS_BYTES(map.numSectors);
+    while (out < end) {
+        int byte = *in++;
+        if (byte) {
+            *out++ = byte;
+        } else {
+            for (int run = *in++; run > 0; run--)
+                *out++ = 0;
+        }
+    }
+}
@@ -0,0 +1,103 @@
+#ifndef MAP_H
+#define MAP_H
+
+#include "platform.h"
+#include "fixed.h"
+
+// Maps are compiled from text (see maps/) by tools/mapc into a binary blob
+// which is linked into ROM. loadMap() copies the arrays drawSector reads most
+// into IWRAM, as many as fit in MAP_IWRAM_SIZE, and points the rest straight
+// into the blob. Whatever is left of the IWRAM is handed out with
+// allocMapIwram for per-map caches sized to the map.
+//
+// A sector's walls are consecutive in the wall arrays. Wall i of a sector runs
+// from the vertex of wall i-1 to its own vertex (wrapping around), and its
+// fill and portal apply to that edge.
+
+#define MAP_MAGIC   0x4D455352 // "RSEM"
+#define MAP_VERSION 4
+
+#define NO_PORTAL   (-1)
+
+// bytes in a sector bitset
+#define PVS_BYTES(numSectors) (((numSectors) + 7) / 8)
+
+// sector light levels are 0 (darkest) to MAX_LIGHT
+#define MAX_LIGHT   15
+
+// limits for per-map caches
+#define MAX_VERTICES    512
+#define MAX_WALLS       1024
+#define MAX_SECTORS     256
+
+// Sector lookup grid, built by loadMap. Cells are square, a power of 2 in
+// size, made as small as these limits allow.
+#define GRID_MAX_CELLS      1024
+#define GRID_MAX_ENTRIES    4096
+#define GRID_MIN_CELL_SHIFT (FPOINT + 1)
+
+// IWRAM reserved for map arrays and per-map caches. The test level takes
+// under 300 bytes; bigger maps leave their largest arrays in ROM.
+#define MAP_IWRAM_SIZE  2048
+
+typedef enum {
+    FILL_SOLID, FILL_TEXTURE, FILL_PARALLAX
+} FillType;
+
+typedef struct Sector {
+    fixed zmin, zmax;
+    u16 firstWall, numWalls;
+    u16 floorFillNum, ceilFillNum;  // color or texture number
+    u8 floorFillType, ceilFillType; // FillType, solid or texture
+    u8 light;                       // 0 to MAX_LIGHT
+    u8 pad;
+} Sector;
+
+// File header. Offsets are in bytes from the start of the map; every array
+// is 4-byte aligned.
+typedef struct {
+    u32 magic;
+    u16 version;
+    u16 numVertices;
+    u16 numWalls;
+    u16 numSectors;
+    u32 vertexX, vertexY;       // fixed[numVertices]
+    u32 sectors;                // Sector[numSectors]
+    u32 wallVertex;             // u16[numWalls], end vertex of each wall
+    u32 wallPortal;             // s16[numWalls], sector or NO_PORTAL
+    u32 wallFillNum;            // u16[numWalls], color or texture number
+    u32 wallFillType;           // u8[numWalls], FillType
+    u32 pvsIndex;               // u16[numSectors], start of each sector's PVS
+    u32 pvsData;                // u8[], see decodePVS
+} MapHeader;
+
+typedef struct {
+    int numVertices, numWalls, numSectors;
+    const fixed * vertexX, * vertexY;
+    const Sector * sectors;
+    const u16 * wallVertex;
+    const s16 * wallPortal;
+    const u16 * wallFillNum;
+    const u8 * wallFillType;
+    const u16 * pvsIndex;
+    const u8 * pvsData;
+    int iwramUsed;      // bytes of MAP_IWRAM_SIZE used
+} Map;
+
+extern Map map;
+
+// return 0 if data isn't a valid map
+int loadMap(const void * data);
+// size bytes of IWRAM until the next loadMap, or 0 if there isn't enough left
+void * allocMapIwram(u32 size);
+// Index of the sector containing (x, y), or -1 if none does. hint is a sector
+// to try first, usually where the point was last (or -1).
+int findSector(fixed x, fixed y, int hint);
+// whether (x, y) is inside sector, edges included
+int pointInSector(int sector, fixed x, fixed y);
+// Unpack the potentially visible set of a sector: a bitset of the sectors
+// which can be seen from anywhere in it, built by mapc. It is stored with
+// runs of zero bytes coded as a 0 followed by the run length.
+void decodePVS(int sector, u8 * out);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+// Everything the renderer needs from the hardware. On the GBA this is just
+// libgba; the host build (HOST_BUILD) provides the same names backed by plain
+// memory so the renderer can be compiled and benchmarked on a PC.
+
+#ifdef HOST_BUILD
+
+#include <stdint.h>
+
+typedef uint8_t     u8;
+typedef uint16_t    u16;
+typedef uint32_t    u32;
+typedef uint64_t    u64;
+typedef int8_t      s8;
+typedef int16_t     s16;
+typedef int32_t     s32;
+typedef int64_t     s64;
+
+#define SCREEN_WIDTH    240
+#define SCREEN_HEIGHT   160
+
+#define IWRAM_CODE
+#define IWRAM_DATA
+#define EWRAM_DATA
+#define EWRAM_BSS
+#define ARM_TARGET
+
+// 96 KB, same as the real thing
+extern u16 hostVram[0xC000];
+#define VRAM ((uintptr_t)hostVram)
+
+void CpuFastSet(const void * source, void * dest, u32 mode);
+void LZ77UnCompWram(const void * source, void * dest);
+
+#else
+
+#include <gba.h>
+
+#define ARM_TARGET __attribute__((target("arm")))
+
+#endif
+
+#endif
@@ -0,0 +1,62 @@
+#include "profile.h"
+
+#ifdef PROFILE
+
+#ifdef HOST_BUILD
+#include <time.h>
+#endif
+
+const char * const profileStageNames[PROF_NUM_STAGES] = {
+    "clip", "project", "slope", "solid", "flat", "texture", "ycb", "sprite", "blit"
+};
+
+EWRAM_BSS ProfileFrame profileLog[PROFILE_LOG_SIZE];
+int profileLogHead;
+ProfileFrame profileCurrent;
+static u32 frameStart;
+
+void profileInit(void) {
+#ifndef HOST_BUILD
+    // TM0 counts cycles, TM1 counts TM0 overflows
+    REG_TM0CNT_H = 0;
+    REG_TM1CNT_H = 0;
+    REG_TM0CNT_L = 0;
+    REG_TM1CNT_L = 0;
+    REG_TM1CNT_H = TIMER_START | TIMER_COUNT;
+    REG_TM0CNT_H = TIMER_START;
+#endif
+    profileLogHead = 0;
+}
+
+u32 profileTime(void) {
+#ifdef HOST_BUILD
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u32)(ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+#else
+    // re-read if TM0 overflowed between the two reads
+    u32 hi, lo;
+    do {
+        hi = REG_TM1CNT_L;
+        lo = REG_TM0CNT_L;
+    } while (hi != REG_TM1CNT_L);
+    return (hi << 16) | lo;
+#endif
+}
+
+void profileBeginFrame(void) {
+    profileCurrent = (ProfileFrame){0};
+    frameStart = profileTime();
+}
+
+void profileEndFrame(void) {
+    profileCurrent.total = profileTime() - frameStart;
+    profileLog[profileLogHead] = profileCurrent;
+    profileLogHead = (profileLogHead + 1) % PROFILE_LOG_SIZE;
+}
+
+const ProfileFrame * profileLastFrame(void) {
+    return &profileLog[(profileLogHead + PROFILE_LOG_SIZE - 1) % PROFILE_LOG_SIZE];
+}
+
+#endif
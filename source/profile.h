@@ -0,0 +1,67 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "platform.h"
+
+// Per-stage timing of the renderer, compiled in only when PROFILE is defined.
+// Times are CPU cycles on the GBA (TM0/TM1 cascade) and nanoseconds on the
+// host build.
+
+typedef enum {
+    PROF_CLIP,      // rotatePoint + clipFrustum
+    PROF_PROJECT,   // reciprocals, projectXY, projectZ
+    PROF_SLOPE,     // calculateSlope
+    PROF_SOLID,     // wallFill
+    PROF_FLAT,      // drawFlat
+    PROF_TEXTURE,   // textureFill
+    PROF_YCB,       // ycbLine
+    PROF_SPRITE,    // drawSprites
+    PROF_BLIT,      // blitScratch, with SCRATCH_BUFFER
+    PROF_NUM_STAGES
+} ProfileStage;
+
+// deeper portal recursion is counted in the last slot
+#define PROFILE_MAX_DEPTH 8
+// frames kept in the log
+#define PROFILE_LOG_SIZE 64
+
+typedef struct {
+    u32 total;
+    u32 stages[PROF_NUM_STAGES];
+    u32 calls[PROF_NUM_STAGES];
+    u32 depths[PROFILE_MAX_DEPTH]; // time in drawSector by portal depth
+} ProfileFrame;
+
+#ifdef PROFILE
+
+extern const char * const profileStageNames[PROF_NUM_STAGES];
+// ring buffer of finished frames, in EWRAM so it can be read out by a debugger
+extern ProfileFrame profileLog[PROFILE_LOG_SIZE];
+extern int profileLogHead; // next entry to be written
+extern ProfileFrame profileCurrent;
+
+void profileInit(void);
+u32 profileTime(void);
+void profileBeginFrame(void);
+void profileEndFrame(void);
+// most recently finished frame
+const ProfileFrame * profileLastFrame(void);
+
+#define PROFILE_BEGIN(t) u32 t = profileTime()
+#define PROFILE_END(t, stage) do { \
+        profileCurrent.stages[stage] += profileTime() - t; \
+        profileCurrent.calls[stage]++; \
+    } while (0)
+#define PROFILE_DEPTH(t, depth) \
+    (profileCurrent.depths[(depth) < PROFILE_MAX_DEPTH ? (depth) : PROFILE_MAX_DEPTH-1] \
+        += profileTime() - t)
+
+#else
+
+#define PROFILE_BEGIN(t)
+#define PROFILE_END(t, stage)
+#define PROFILE_DEPTH(t, depth)
+
+#endif
+
+#endif
@@ -0,0 +1,42 @@
+//
+// Reciprocal lut; 257 entries, 15 fixeds
+// recip_lut[i] = round(2^23 / (256 + i)), ie. 1/m for m in [1, 2]
+// (the extra entry is for interpolating the last step)
+//
+
+const unsigned short recip_lut[257]=
+{
+	0x8000, 0x7F80, 0x7F02, 0x7E84, 0x7E08, 0x7D8C, 0x7D12, 0x7C98, 
+	0x7C1F, 0x7BA7, 0x7B30, 0x7ABA, 0x7A45, 0x79D0, 0x795D, 0x78EA, 
+	0x7878, 0x7808, 0x7797, 0x7728, 0x76BA, 0x764C, 0x75DF, 0x7573, 
+	0x7507, 0x749D, 0x7433, 0x73CA, 0x7361, 0x72FA, 0x7293, 0x722D, 
+	0x71C7, 0x7162, 0x70FE, 0x709B, 0x7038, 0x6FD6, 0x6F75, 0x6F14, 
+	0x6EB4, 0x6E54, 0x6DF6, 0x6D98, 0x6D3A, 0x6CDD, 0x6C81, 0x6C25, 
+	0x6BCA, 0x6B70, 0x6B16, 0x6ABC, 0x6A64, 0x6A0C, 0x69B4, 0x695D, 
+	0x6907, 0x68B1, 0x685B, 0x6807, 0x67B2, 0x675E, 0x670B, 0x66B9, 
+	0x6666, 0x6615, 0x65C4, 0x6573, 0x6523, 0x64D3, 0x6484, 0x6435, 
+	0x63E7, 0x6399, 0x634C, 0x62FF, 0x62B3, 0x6267, 0x621C, 0x61D1, 
+	0x6186, 0x613C, 0x60F2, 0x60A9, 0x6060, 0x6018, 0x5FD0, 0x5F89, 
+	0x5F41, 0x5EFB, 0x5EB5, 0x5E6F, 0x5E29, 0x5DE4, 0x5D9F, 0x5D5B, 
+	0x5D17, 0x5CD4, 0x5C91, 0x5C4E, 0x5C0C, 0x5BCA, 0x5B88, 0x5B47, 
+	0x5B06, 0x5AC5, 0x5A85, 0x5A45, 0x5A06, 0x59C6, 0x5988, 0x5949, 
+	0x590B, 0x58CD, 0x5890, 0x5853, 0x5816, 0x57DA, 0x579D, 0x5762, 
+	0x5726, 0x56EB, 0x56B0, 0x5676, 0x563B, 0x5601, 0x55C8, 0x558E, 
+	0x5555, 0x551D, 0x54E4, 0x54AC, 0x5474, 0x543D, 0x5405, 0x53CE, 
+	0x5398, 0x5361, 0x532B, 0x52F5, 0x52BF, 0x528A, 0x5255, 0x5220, 
+	0x51EC, 0x51B7, 0x5183, 0x514F, 0x511C, 0x50E9, 0x50B6, 0x5083, 
+	0x5050, 0x501E, 0x4FEC, 0x4FBA, 0x4F89, 0x4F57, 0x4F26, 0x4EF6, 
+	0x4EC5, 0x4E95, 0x4E64, 0x4E35, 0x4E05, 0x4DD5, 0x4DA6, 0x4D77, 
+	0x4D48, 0x4D1A, 0x4CEC, 0x4CBD, 0x4C90, 0x4C62, 0x4C34, 0x4C07, 
+	0x4BDA, 0x4BAD, 0x4B81, 0x4B54, 0x4B28, 0x4AFC, 0x4AD0, 0x4AA4, 
+	0x4A79, 0x4A4E, 0x4A23, 0x49F8, 0x49CD, 0x49A3, 0x4979, 0x494E, 
+	0x4925, 0x48FB, 0x48D1, 0x48A8, 0x487F, 0x4856, 0x482D, 0x4805, 
+	0x47DC, 0x47B4, 0x478C, 0x4764, 0x473C, 0x4715, 0x46ED, 0x46C6, 
+	0x469F, 0x4678, 0x4651, 0x462B, 0x4604, 0x45DE, 0x45B8, 0x4592, 
+	0x456C, 0x4547, 0x4521, 0x44FC, 0x44D7, 0x44B2, 0x448D, 0x4469, 
+	0x4444, 0x4420, 0x43FC, 0x43D8, 0x43B4, 0x4390, 0x436D, 0x4349, 
+	0x4326, 0x4303, 0x42E0, 0x42BD, 0x429A, 0x4277, 0x4255, 0x4233, 
+	0x4211, 0x41EE, 0x41CD, 0x41AB, 0x4189, 0x4168, 0x4146, 0x4125, 
+	0x4104, 0x40E3, 0x40C2, 0x40A2, 0x4081, 0x4061, 0x4040, 0x4020, 
+	0x4000, 
+};
@@ -0,0 +1,1246 @@
+#include "render.h"
+#include "profile.h"
+#include "light.h"
+#include "texcache.h"
+#include "tonc_bmp8.h"
+
+// Y Clip Buffer, indexed by screen column
+typedef s16 * YCB;
+// num hwords
+#define YCB_SIZE 128
+// hwords of clip buffer for portal windows per frame, two per column of each
+// window. That's 8 full width windows; the test level peaks at 240 hwords
+// (the bench's ycb column). Portals past it are drawn as walls and counted
+// in RenderStats.portalsDropped.
+#define YCB_ARENA_SIZE 2048
+
+// Portal windows waiting to be drawn. Power of 2; it only has to hold about
+// two levels of portals at once.
+#define PORTAL_QUEUE_SIZE 32
+// portal windows drawn per frame at most, to bound frame time
+#define MAX_PORTALS_PER_FRAME 64
+
+// sprites in front of the camera drawn per frame at most
+#define MAX_VISIBLE_SPRITES 32
+// sprites closer than this are skipped rather than drawn huge
+#define SPRITE_NEAR (FUNIT/4)
+
+// frustum sides a vertex is outside of, see clipFrustum
+#define OUTSIDE_A 1
+#define OUTSIDE_B 2
+
+// A vertex in camera space, cached for the rest of the frame once a sector
+// using it has been visited
+typedef struct {
+    fixed x, y;
+    fixed recip;    // FRECIP_FAST(x), 0 until needed
+    u16 frame;      // frameCount when cached
+    u8 outside;     // OUTSIDE_A | OUTSIDE_B
+} CachedVertex;
+
+// screen-space line, y = y + slope per column
+typedef struct {
+    fixed y, slope;
+} Edge;
+
+// a sector to draw through a portal, see drawFrame
+typedef struct {
+    const Sector * sector;
+    YCB minYCB, maxYCB;
+    s16 xClipMin, xClipMax;
+    int depth;
+} PortalWindow;
+
+// Columns of a window that no wall has been drawn in yet, a bit each. A
+// sector is convex, so its walls cover each column of its window once, and
+// when none are left the rest of its walls can't be seen.
+#define COLUMN_MASK_WORDS ((M4WIDTH + 31) / 32)
+typedef u32 ColumnMask[COLUMN_MASK_WORDS];
+
+// a sprite in camera space, see drawSprites
+typedef struct {
+    const Sprite * sprite;
+    fixed x, y;
+} ViewSprite;
+
+// wall edges from top to bottom
+enum {
+    EDGE_CEIL, EDGE_PORTAL_TOP, EDGE_PORTAL_BOTTOM, EDGE_FLOOR, NUM_EDGES
+};
+
+// textures repeat every 2^TEXTURE_REPEAT_PWR world units along a wall
+#define TEXTURE_REPEAT_PWR 1
+// extra precision bits of 1/z in TexMapping
+// (same as FPOINT so the perspective divide is an FDIV)
+#define IZ_SHIFT FPOINT
+// do the perspective divide every 2^TEX_SPAN_PWR columns, interpolate between
+#define TEX_SPAN_PWR 3
+#define TEX_SPAN (1<<TEX_SPAN_PWR)
+
+// for code generated per texture size, see textureColumnSized
+#define FORCE_INLINE __attribute__((always_inline))
+
+// Light is lost with distance, up to LIGHT_FALLOFF levels far away. The
+// levels kept are linear in 1/z, which walls already interpolate: 1/z <<
+// IZ_SHIFT >> LIGHT_IZ_SHIFT is 2^(16 - LIGHT_IZ_SHIFT) / z, capped at
+// LIGHT_FALLOFF. So nothing is lost up to 2 units away, 4 levels are lost by
+// 4 units, 7 by 16 units, and all 8 beyond that.
+#define LIGHT_FALLOFF 8
+#define LIGHT_IZ_SHIFT 12
+
+// Rows of a floor or ceiling visible in each column, [top, bottom), filled
+// in by wallFill. Drawn as horizontal spans once all of a sector's walls
+// are done, since rows are contiguous in VRAM and at a constant distance.
+typedef struct {
+    u8 top[M4WIDTH], bottom[M4WIDTH];
+} FlatPlane;
+
+// Horizontal texture coordinate across a wall. u/z and 1/z are linear in
+// screen space, u is recovered by dividing the two.
+typedef struct {
+    s32 iz, izStep; // 1/z << IZ_SHIFT, per column
+    s32 uz, uzStep; // u * 1/z (u and 1/z both fixed)
+} TexMapping;
+
+static inline void rotatePoint(fixed x, fixed y, fixed sint, fixed cost,
+    fixed * xout, fixed * yout);
+
+static inline CachedVertex * cameraVertex(int vertex, fixed sint, fixed cost);
+static void drawSector(const Sector * sector, fixed sint, fixed cost,
+    int xClipMin, int xClipMax, YCB minYCB, YCB maxYCB, int depth);
+static inline int frustumOutside(fixed x, fixed y);
+static inline int lodFlat(int wall, fixed nearRecip);
+// looking down x axis
+// points should be ordered left to right on screen
+// outside1/2 are the frustumOutside() bits of each point
+// return if on screen
+static inline int clipFrustum(fixed * x1, fixed * y1, fixed * x2, fixed * y2,
+    int outside1, int outside2);
+static inline fixed vertexRecip(CachedVertex * vertex, fixed x);
+static inline void projectXY(fixed x1recip, fixed y1, fixed x2recip, fixed y2,
+    int * outScrX1, int * outScrX2);
+static inline void projectZ(fixed x1recip, fixed x2recip, fixed z,
+    int * outScrY1, int * outScrY2);
+static inline void calculateSlope(fixed x1, fixed y1, fixed x2, fixed y2,
+    int xDrawMin, fixed * yStartOut, fixed * slopeOut);
+static inline void ycbLine(int xDrawMin, int xDrawMax, fixed yStart, fixed slope,
+    YCB minYCB, YCB maxYCB, YCB outYCB);
+static inline int trimWindow(int * xMin, int * xMax, YCB minYCB, YCB maxYCB);
+#ifdef COLUMN_DEPTH
+static inline void stepDepth(int xDrawMin, int xDrawMax, const Edge * edges,
+    YCB minYCB, YCB maxYCB, YCB portalMin, YCB portalMax, s32 iz, s32 izStep);
+#endif
+static inline int openColumns(int xMin, int xMax, YCB minYCB, YCB maxYCB, ColumnMask open);
+static inline int closeColumns(ColumnMask open, int xMin, int xMax);
+static inline void columnFill(u16 * dst, int count, int color);
+static void rowFill(u16 * dst, int count, int color);
+static void wallFill(int xDrawMin, int xDrawMax, const Edge * edges,
+    YCB minYCB, YCB maxYCB, int wallColor, s32 iz, s32 izStep, int light);
+static void drawFlat(const FlatPlane * plane, int xMin, int xMax, fixed z,
+    int fillType, int fillNum, int light, fixed sint, fixed cost);
+static inline void inverseDepth(fixed scrX1, fixed scrX2, fixed x1recip, fixed x2recip,
+    int xDrawMin, s32 * izOut, s32 * izStepOut);
+static inline void textureMapping(fixed scrX1, fixed scrX2,
+    fixed x1recip, fixed x2recip, fixed u1, fixed u2, int xDrawMin, TexMapping * out);
+static int textureFill(int xDrawMin, int xDrawMax,
+    fixed yStart1, fixed slope1, fixed yStart2, fixed slope2,
+    YCB minYCB, YCB maxYCB, TexMapping mapping, Texture texture, int light);
+static void drawSprites(fixed sint, fixed cost);
+static void drawSprite(const ViewSprite * view);
+#ifdef SCRATCH_BUFFER
+static void blitScratch(void);
+#endif
+
+// intersect with frustum lines
+static inline void intersectA(fixed crossX, fixed x1, fixed y1, fixed x2, fixed y2,
+        fixed * xint) {
+    fixed det = -(x1-x2) + y1-y2;
+    if (det == 0)
+        det = 1;
+    *xint = FDIV_FAST(-crossX, det);
+}
+static inline void intersectB(fixed crossX, fixed x1, fixed y1, fixed x2, fixed y2,
+        fixed * xint, fixed * yint) {
+    fixed det = (x1-x2) + y1-y2;
+    if (det == 0)
+        det = 1;
+    *xint = FDIV_FAST(-crossX, det);
+    *yint = -(*xint);
+}
+
+IWRAM_CODE
+ARM_TARGET
+static inline void rotatePoint(fixed x, fixed y, fixed sint, fixed cost,
+        fixed * xout, fixed * yout) {
+    fixed newx = FMULT(x, cost) - FMULT(y, sint);
+    *yout = FMULT(y, cost) + FMULT(x, sint);
+    *xout = newx;
+}
+
+// color map for a sector's light at depth 1/z << IZ_SHIFT
+IWRAM_CODE
+ARM_TARGET
+static inline const u16 * lightMap(int light, s32 iz) {
+    int near = iz >> LIGHT_IZ_SHIFT;
+    int level = light - LIGHT_FALLOFF + (near < LIGHT_FALLOFF ? near : LIGHT_FALLOFF);
+    return colorMaps[level > 0 ? level : 0];
+}
+
+fixed camX = 0, camY = 0, camZ = 0;
+
+#ifdef RENDER_STATS
+RenderStats renderStats;
+#endif
+
+// page being drawn to, see setRenderTarget
+static MODE4_LINE * frameBuffer;
+
+#ifdef SCRATCH_BUFFER
+// The frame is drawn column-major here, so columns are written sequentially,
+// then copied to the page by blitScratch. It's too big for IWRAM, see
+// render.h for what that costs.
+EWRAM_BSS static u16 scratchBuffer[M4WIDTH * SCREEN_HEIGHT] __attribute__((aligned(4)));
+#define PIXEL(x, y) (scratchBuffer + (x) * SCREEN_HEIGHT + (y))
+// hwords from a pixel to the one below it, and to the one right of it
+#define COLUMN_STEP 1
+#define ROW_STEP SCREEN_HEIGHT
+#else
+#define PIXEL(x, y) (&frameBuffer[y][x])
+#define COLUMN_STEP M4WIDTH
+#define ROW_STEP 1
+#endif
+
+// min and max YCB of the whole screen
+static s16 screenYCBs[2 * YCB_SIZE];
+// Clip buffers for portal windows, allocated for the rest of the frame. A
+// portal takes two buffers covering only its own columns.
+static s16 ycbArena[YCB_ARENA_SIZE];
+static int ycbArenaTop;
+
+// floor and ceiling of the sector being drawn
+static FlatPlane floorPlane, ceilPlane;
+
+// sectors visible from the camera's sector, see decodePVS
+static u8 pvsVisible[PVS_BYTES(MAX_SECTORS)];
+static const Sector * pvsSector;
+
+// ring buffer of windows to draw, oldest first
+static PortalWindow portalQueue[PORTAL_QUEUE_SIZE];
+static int queueHead, queueCount;
+static int portalCount;
+// Every window drawn this frame, in order. Sprites are clipped to the windows
+// of their sector, which hold everything in front of it.
+static PortalWindow drawnWindows[MAX_PORTALS_PER_FRAME + 1];
+static int drawnCount;
+
+// Textured walls drawn flat last time they were seen, a bit per wall, and the
+// 1/distance for going flat and for going back to textured. See setLodDistance.
+static u8 lodFlatWalls[(MAX_WALLS + 7) / 8];
+static fixed lodFlatRecip, lodTextureRecip;
+// see setMipBias
+static int mipBias;
+
+// see setSprites
+static const Sprite * spriteList;
+static int spriteCount;
+
+#ifdef COLUMN_DEPTH
+// 1/z << IZ_SHIFT of the wall closing each column, 0 for none. Each column is
+// closed by exactly one wall, so the order sectors are drawn in doesn't matter.
+static s32 columnDepth[M4WIDTH];
+// the same for the nearest wall drawn in each column, which can be the step
+// above or below a portal
+static s32 columnNearest[M4WIDTH];
+// camera position and angle of the last frame, for inFrontOfWall
+static fixed viewX, viewY, viewSin, viewCos;
+#endif
+
+// An entry per map vertex, in the map's IWRAM if there's room left after its
+// arrays (see allocMapIwram), or else in EWRAM
+static CachedVertex * vertexCache;
+EWRAM_BSS static CachedVertex vertexCacheEwram[MAX_VERTICES];
+// never 0, so zeroed cache entries are stale
+static int frameCount;
+
+static void clearVertexCache(void) {
+    for (int i = 0; i < map.numVertices; i++)
+        vertexCache[i].frame = 0;
+    frameCount = 1;
+}
+
+void initRenderer(void) {
+    const int zero = 0;
+    const int yMaxFill = SCREEN_HEIGHT | (SCREEN_HEIGHT << 16);
+    // clear ymin/max buffers
+    CpuFastSet(&zero, screenYCBs, 64 | (1<<24));
+    CpuFastSet(&yMaxFill, screenYCBs + YCB_SIZE, 64 | (1<<24));
+    vertexCache = allocMapIwram(map.numVertices * sizeof(CachedVertex));
+    if (!vertexCache)
+        vertexCache = vertexCacheEwram;
+    clearVertexCache();
+    frameBuffer = MODE4_FB;
+    pvsSector = 0;
+    setLodDistance(LOD_DISTANCE);
+    mipBias = 0;
+#ifdef PROFILE
+    profileInit();
+#endif
+}
+
+void setRenderTarget(MODE4_LINE * target) {
+    frameBuffer = target;
+}
+
+void setLodDistance(fixed distance) {
+    for (int i = 0; i < (MAX_WALLS + 7) / 8; i++)
+        lodFlatWalls[i] = 0;
+    lodFlatRecip = distance > 0 ? FRECIP_FAST(distance) : 0;
+    lodTextureRecip = distance > 0 ? FRECIP_FAST(distance - (distance >> 3)) : 0;
+}
+
+void setMipBias(int bias) {
+    // a negative bias would shift by a negative amount in textureFill
+    mipBias = bias > 0 ? bias : 0;
+}
+
+void setSprites(const Sprite * sprites, int count) {
+    spriteList = sprites;
+    spriteCount = count;
+}
+
+void drawFrame(const Sector * sector, fixed sint, fixed cost) {
+    if (++frameCount > 0xFFFF)
+        clearVertexCache();
+    YCB screenMin = screenYCBs;
+    YCB screenMax = screenYCBs + YCB_SIZE;
+    ycbArenaTop = 0;
+    portalCount = 0;
+    drawnCount = 0;
+#ifdef COLUMN_DEPTH
+    for (int x = 0; x < M4WIDTH; x++)
+        columnDepth[x] = columnNearest[x] = 0;
+    viewX = camX;
+    viewY = camY;
+    viewSin = sint;
+    viewCos = cost;
+#endif
+    if (sector != pvsSector) {
+        decodePVS(sector - map.sectors, pvsVisible);
+        pvsSector = sector;
+    }
+#ifdef PROFILE
+    profileBeginFrame();
+#endif
+    // Draw breadth first: drawSector queues the windows of the portals it
+    // finds instead of recursing, so stack use doesn't grow with depth.
+    // Windows of the same sector never overlap, so order doesn't matter.
+    queueHead = 0;
+    queueCount = 1;
+    portalQueue[0] = (PortalWindow){sector, screenMin, screenMax, 0, M4WIDTH, 1};
+    while (queueCount > 0) {
+        PortalWindow window = portalQueue[queueHead];
+        queueHead = (queueHead + 1) & (PORTAL_QUEUE_SIZE - 1);
+        queueCount--;
+        drawSector(window.sector, sint, cost, window.xClipMin, window.xClipMax,
+            window.minYCB, window.maxYCB, window.depth);
+        drawnWindows[drawnCount++] = window;
+    }
+    // the clip buffers of the windows are still there until the next frame
+    drawSprites(sint, cost);
+#ifdef SCRATCH_BUFFER
+    blitScratch();
+#endif
+    updateTextureCache();
+#ifdef PROFILE
+    profileEndFrame();
+#endif
+}
+
+// camera space vertex, transformed on first use each frame
+IWRAM_CODE
+ARM_TARGET
+static inline CachedVertex * cameraVertex(int v, fixed sint, fixed cost) {
+    CachedVertex * vertex = vertexCache + v;
+    if (vertex->frame != frameCount) {
+        vertex->frame = frameCount;
+        rotatePoint(map.vertexX[v] - camX, map.vertexY[v] - camY, -sint, cost,
+            &vertex->x, &vertex->y);
+        vertex->recip = 0;
+        vertex->outside = frustumOutside(vertex->x, vertex->y);
+        STAT_ADD(vertices, 1);
+    }
+    return vertex;
+}
+
+IWRAM_CODE
+ARM_TARGET
+static void drawSector(const Sector * sector, fixed sint, fixed cost,
+        int xClipMin, int xClipMax, YCB minYCB, YCB maxYCB, int depth) {
+    PROFILE_BEGIN(sectorStart);
+    STAT_ADD(sectors, 1);
+    for (int x = xClipMin; x < xClipMax; x++) {
+        ceilPlane.top[x] = ceilPlane.bottom[x] = 0;
+        floorPlane.top[x] = floorPlane.bottom[x] = 0;
+    }
+
+    ColumnMask open;
+    openColumns(xClipMin, xClipMax, minYCB, maxYCB, open);
+
+    int firstWall = sector->firstWall, numWalls = sector->numWalls;
+    CachedVertex * cur, * prev = cameraVertex(map.wallVertex[firstWall + numWalls - 1], sint, cost);
+    for (int wall = firstWall; wall < firstWall + numWalls; wall++, prev = cur) {
+        PROFILE_BEGIN(clipStart);
+        cur = cameraVertex(map.wallVertex[wall], sint, cost);
+        fixed tX = cur->x, tY = cur->y, prevTX = prev->x, prevTY = prev->y;
+        STAT_ADD(walls, 1);
+
+        fixed x1 = tX, y1 = tY, x2 = prevTX, y2 = prevTY;
+        int visible = clipFrustum(&x1, &y1, &x2, &y2, cur->outside, prev->outside);
+        PROFILE_END(clipStart, PROF_CLIP);
+        if (!visible)
+            continue;
+
+        PROFILE_BEGIN(projectStart);
+        fixed x1recip = vertexRecip(cur, x1), x2recip = vertexRecip(prev, x2);
+        fixed scrX1, scrX2;
+        projectXY(x1recip, y1, x2recip, y2, &scrX1, &scrX2);
+        PROFILE_END(projectStart, PROF_PROJECT);
+        int xDrawMin = scrX1 / FUNIT;
+        int xDrawMax = scrX2 / FUNIT;
+        if (xDrawMax <= xDrawMin || xDrawMax < xClipMin || xDrawMin >= xClipMax)
+            continue;
+        if (xDrawMin < xClipMin)
+            xDrawMin = xClipMin;
+        if (xDrawMax > xClipMax)
+            xDrawMax = xClipMax;
+
+        fixed scrYMin1, scrYMax1, scrYMin2, scrYMax2;
+        projectZ(x1recip, x2recip, sector->zmax-camZ, &scrYMin1, &scrYMin2);
+        projectZ(x1recip, x2recip, sector->zmin-camZ, &scrYMax1, &scrYMax2);
+
+        Edge edges[NUM_EDGES];
+        calculateSlope(scrX1, scrYMin1, scrX2, scrYMin2, xDrawMin,
+            &edges[EDGE_CEIL].y, &edges[EDGE_CEIL].slope);
+        calculateSlope(scrX1, scrYMax1, scrX2, scrYMax2, xDrawMin,
+            &edges[EDGE_FLOOR].y, &edges[EDGE_FLOOR].slope);
+        // solid walls cover ceiling to floor: empty top wall, full bottom wall
+        edges[EDGE_PORTAL_TOP] = edges[EDGE_CEIL];
+        edges[EDGE_PORTAL_BOTTOM] = edges[EDGE_CEIL];
+
+        // 1/z across the wall, for light and the depth buffer
+        s32 iz, izStep;
+        inverseDepth(scrX1, scrX2, x1recip, x2recip, xDrawMin, &iz, &izStep);
+
+        int portal = map.wallPortal[wall];
+        int ycbWidth = xDrawMax - xDrawMin;
+        if (portal != NO_PORTAL && !(pvsVisible[portal >> 3] & (1 << (portal & 7)))) {
+            // can't be seen from the camera's sector (so this can only be a
+            // sliver at the edge of a window), draw it as a wall
+            portal = NO_PORTAL;
+            STAT_ADD(pvsCulled, 1);
+        }
+        if (portal != NO_PORTAL && (ycbArenaTop + 2 * ycbWidth > YCB_ARENA_SIZE
+                || queueCount == PORTAL_QUEUE_SIZE || portalCount == MAX_PORTALS_PER_FRAME)) {
+            // over a limit, draw the portal as a wall instead
+            portal = NO_PORTAL;
+            STAT_ADD(portalsDropped, 1);
+        }
+        if (portal != NO_PORTAL) {
+            const Sector * portalSector = map.sectors + portal;
+            edges[EDGE_PORTAL_BOTTOM] = edges[EDGE_FLOOR];
+            if (portalSector->zmax < sector->zmax) {
+                // top wall
+                fixed portalScrYMin1, portalScrYMin2;
+                projectZ(x1recip, x2recip, portalSector->zmax-camZ, &portalScrYMin1, &portalScrYMin2);
+                calculateSlope(scrX1, portalScrYMin1, scrX2, portalScrYMin2, xDrawMin,
+                    &edges[EDGE_PORTAL_TOP].y, &edges[EDGE_PORTAL_TOP].slope);
+            }
+            if (portalSector->zmin > sector->zmin) {
+                // bottom wall
+                fixed portalScrYMax1, portalScrYMax2;
+                projectZ(x1recip, x2recip, portalSector->zmin-camZ, &portalScrYMax1, &portalScrYMax2);
+                calculateSlope(scrX1, portalScrYMax1, scrX2, portalScrYMax2, xDrawMin,
+                    &edges[EDGE_PORTAL_BOTTOM].y, &edges[EDGE_PORTAL_BOTTOM].slope);
+            }
+            wallFill(xDrawMin, xDrawMax, edges, minYCB, maxYCB, map.wallFillNum[wall],
+                iz, izStep, sector->light);
+            // offset so they can be indexed by column like the screen YCBs
+            YCB newYCB1 = ycbArena + ycbArenaTop - xDrawMin;
+            YCB newYCB2 = newYCB1 + ycbWidth;
+            ycbArenaTop += 2 * ycbWidth;
+#ifdef RENDER_STATS
+            if (ycbArenaTop > renderStats.ycbPeak)
+                renderStats.ycbPeak = ycbArenaTop;
+#endif
+            ycbLine(xDrawMin, xDrawMax, edges[EDGE_PORTAL_TOP].y, edges[EDGE_PORTAL_TOP].slope,
+                minYCB, maxYCB, newYCB1);
+            ycbLine(xDrawMin, xDrawMax, edges[EDGE_PORTAL_BOTTOM].y, edges[EDGE_PORTAL_BOTTOM].slope,
+                minYCB, maxYCB, newYCB2);
+#ifdef COLUMN_DEPTH
+            stepDepth(xDrawMin, xDrawMax, edges, minYCB, maxYCB, newYCB1, newYCB2, iz, izStep);
+#endif
+            int xPortalMin = xDrawMin, xPortalMax = xDrawMax;
+            if (trimWindow(&xPortalMin, &xPortalMax, newYCB1, newYCB2)) {
+                portalQueue[(queueHead + queueCount) & (PORTAL_QUEUE_SIZE - 1)] = (PortalWindow){
+                    portalSector, newYCB1, newYCB2, xPortalMin, xPortalMax, depth + 1};
+                queueCount++;
+                portalCount++;
+            } else {
+                // closed off by the walls above and below it, give the
+                // buffers back
+                ycbArenaTop -= 2 * ycbWidth;
+                STAT_ADD(windowsClosed, 1);
+            }
+        } else {
+#ifdef COLUMN_DEPTH
+            s32 columnIz = iz;
+            for (int x = xDrawMin; x < xDrawMax; x++, columnIz += izStep) {
+                columnDepth[x] = columnIz;
+                if (columnIz > columnNearest[x])
+                    columnNearest[x] = columnIz;
+            }
+#endif
+            switch(map.wallFillType[wall]) {
+                case FILL_SOLID:
+                    wallFill(xDrawMin, xDrawMax, edges, minYCB, maxYCB, map.wallFillNum[wall],
+                        iz, izStep, sector->light);
+                    break;
+                case FILL_TEXTURE: {
+                    int texture = map.wallFillNum[wall];
+                    if (lodFlat(wall, x1recip > x2recip ? x1recip : x2recip)) {
+                        wallFill(xDrawMin, xDrawMax, edges, minYCB, maxYCB,
+                            textures[texture].average, iz, izStep, sector->light);
+                        STAT_ADD(lodWalls, 1);
+                        break;
+                    }
+                    // leave the whole wall open for the texture
+                    edges[EDGE_PORTAL_BOTTOM] = edges[EDGE_FLOOR];
+                    wallFill(xDrawMin, xDrawMax, edges, minYCB, maxYCB, 0,
+                        iz, izStep, sector->light);
+                    // u is the distance along the wall from its left vertex
+                    fixed wallDX = prevTX - tX, wallDY = prevTY - tY;
+                    fixed length = FSQRT(FMULT(wallDX, wallDX) + FMULT(wallDY, wallDY));
+                    if (length == 0)
+                        length = 1;
+                    fixed u1 = FDIV_FAST(FMULT(x1 - tX, wallDX) + FMULT(y1 - tY, wallDY), length);
+                    fixed u2 = FDIV_FAST(FMULT(x2 - tX, wallDX) + FMULT(y2 - tY, wallDY), length);
+                    TexMapping mapping;
+                    textureMapping(scrX1, scrX2, x1recip, x2recip, u1, u2, xDrawMin, &mapping);
+                    textureUse[texture] += textureFill(xDrawMin, xDrawMax,
+                        edges[EDGE_CEIL].y, edges[EDGE_CEIL].slope,
+                        edges[EDGE_FLOOR].y, edges[EDGE_FLOOR].slope,
+                        minYCB, maxYCB, mapping, textures[texture], sector->light);
+                    break;
+                }
+            }
+        }
+        if (!closeColumns(open, xDrawMin, xDrawMax)) {
+            // every column of the window has its wall
+            STAT_ADD(wallsSkipped, firstWall + numWalls - 1 - wall);
+            break;
+        }
+    }
+    drawFlat(&ceilPlane, xClipMin, xClipMax, sector->zmax - camZ,
+        sector->ceilFillType, sector->ceilFillNum, sector->light, sint, cost);
+    drawFlat(&floorPlane, xClipMin, xClipMax, sector->zmin - camZ,
+        sector->floorFillType, sector->floorFillNum, sector->light, sint, cost);
+    PROFILE_DEPTH(sectorStart, depth - 1);
+}
+
+// Whether a textured wall is far enough away to be drawn flat, given the
+// 1/distance of its nearest end. Updates its state for next time.
+IWRAM_CODE
+ARM_TARGET
+static inline int lodFlat(int wall, fixed nearRecip) {
+    u8 * flat = lodFlatWalls + (wall >> 3);
+    int bit = 1 << (wall & 7);
+    if (nearRecip < (*flat & bit ? lodTextureRecip : lodFlatRecip)) {
+        *flat |= bit;
+        return 1;
+    }
+    *flat &= ~bit;
+    return 0;
+}
+
+IWRAM_CODE
+ARM_TARGET
+static inline int frustumOutside(fixed x, fixed y) {
+    // clip points using a 90 degree frustum, defined by two lines (a and b)
+    // x - y > 0 && x + y > 0
+    return (x - y < 0 ? OUTSIDE_A : 0) | (x + y < 0 ? OUTSIDE_B : 0);
+}
+
+IWRAM_CODE
+ARM_TARGET
+static inline int clipFrustum(fixed * x1, fixed * y1, fixed * x2, fixed * y2,
+        int outside1, int outside2) {
+#ifdef DEBUG_LINES
+    bmp8_line(*x1/32 + 120, -*y1/32 + 80, *x2/32 + 120, -*y2/32 + 80,
+              8, (void*)frameBuffer, 240);
+#endif
+    int p1OutsideA = outside1 & OUTSIDE_A;
+    int p2OutsideA = outside2 & OUTSIDE_A;
+    int p1OutsideB = outside1 & OUTSIDE_B;
+    int p2OutsideB = outside2 & OUTSIDE_B;
+
+    // both points outside frustum on same side
+    // or points are backwards
+    if ((p1OutsideA && p2OutsideA) || (p1OutsideB && p2OutsideB)
+            || (p2OutsideA && !p2OutsideB) || (p1OutsideB && !p1OutsideA))
+        return 0;
+
+    if (p1OutsideA || p2OutsideB) {
+        fixed crossX = cross(*x1, *y1, *x2, *y2);
+        // TODO: why do I have to do this?? also why do lines shake more
+        fixed newX1 = 0;
+        if (p1OutsideA)
+            intersectA(crossX, *x1, *y1, *x2, *y2, &newX1);
+        if (p2OutsideB)
+            intersectB(crossX, *x1, *y1, *x2, *y2, x2, y2);
+        if (p1OutsideA)
+            *x1 = *y1 = newX1;
+    }
+
+#ifdef DEBUG_LINES
+    bmp8_line(*x1/32 + 120, -*y1/32 + 80, *x2/32 + 120, -*y2/32 + 80,
+              7, (void*)frameBuffer, 240);
+    return 0; // will prevent drawing line
+#endif
+    // Prevent future divide by zero with projection. A wall passing through
+    // the camera clips to the apex, which rounding can put a hair behind it,
+    // and a negative depth would turn 1/z and u/z around mid-wall.
+    if (*x1 <= 0)
+        *x1 = 1;
+    if (*x2 <= 0)
+        *x2 = 1;
+    return 1;
+}
+
+// FRECIP_FAST of a clipped x, reusing the vertex's if it wasn't clipped
+IWRAM_CODE
+ARM_TARGET
+static inline fixed vertexRecip(CachedVertex * vertex, fixed x) {
+    if (x != vertex->x)
+        return FRECIP_FAST(x);
+    if (vertex->recip == 0)
+        vertex->recip = FRECIP_FAST(x);
+    return vertex->recip;
+}
+
+IWRAM_CODE
+ARM_TARGET
+static inline void projectXY(fixed x1recip, fixed y1, fixed x2recip, fixed y2,
+        int * outScrX1, int * outScrX2) {
+    *outScrX1 = M4WIDTH/2*FUNIT - FMULT(y1*FUNIT, x1recip)/4;
+    *outScrX2 = M4WIDTH/2*FUNIT - FMULT(y2*FUNIT, x2recip)/4;
+}
+
+IWRAM_CODE
+ARM_TARGET
+static inline void projectZ(fixed x1recip, fixed x2recip, fixed z,
+        int * outScrY1, int * outScrY2) {
+    PROFILE_BEGIN(start);
+    z *= FUNIT;
+    *outScrY1 = HORIZON*FUNIT - FMULT(z, x1recip)/2;
+    *outScrY2 = HORIZON*FUNIT - FMULT(z, x2recip)/2;
+    PROFILE_END(start, PROF_PROJECT);
+}
+
+IWRAM_CODE
+ARM_TARGET
+static inline void calculateSlope(fixed x1, fixed y1, fixed x2, fixed y2,
+        int xDrawMin, fixed * yStartOut, fixed * slopeOut) {
+    PROFILE_BEGIN(start);
+    *slopeOut = FDIV_FAST(y2 - y1, x2 - x1);
+    *yStartOut = y1 + FMULT(xDrawMin*FUNIT - x1, *slopeOut);
+    PROFILE_END(start, PROF_SLOPE);
+}
+
+IWRAM_CODE
+ARM_TARGET
+static inline void ycbLine(int xDrawMin, int xDrawMax, fixed yStart, fixed slope,
+        YCB minYCB, YCB maxYCB, YCB outYCB) {
+    PROFILE_BEGIN(start);
+    fixed y = yStart;
+    for (int x = xDrawMin; x < xDrawMax; x++) {
+        int min = minYCB[x], max = maxYCB[x];
+        int curY = y/FUNIT;
+        if (curY < min)
+            curY = min;
+        if (curY > max)
+            curY = max;
+        outYCB[x] = curY;
+        y += slope;
+    }
+    PROFILE_END(start, PROF_YCB);
+}
+
+#ifdef COLUMN_DEPTH
+// Record a portal's steps in columnNearest where they show: the rows between
+// its wall's ceiling and floor that its window (portalMin to portalMax)
+// doesn't take.
+IWRAM_CODE
+ARM_TARGET
+static inline void stepDepth(int xDrawMin, int xDrawMax, const Edge * edges,
+        YCB minYCB, YCB maxYCB, YCB portalMin, YCB portalMax, s32 iz, s32 izStep) {
+    fixed yCeil = edges[EDGE_CEIL].y, yFloor = edges[EDGE_FLOOR].y;
+    for (int x = xDrawMin; x < xDrawMax; x++, iz += izStep,
+            yCeil += edges[EDGE_CEIL].slope, yFloor += edges[EDGE_FLOOR].slope) {
+        int min = minYCB[x], max = maxYCB[x];
+        int ceil = yCeil/FUNIT, floor = yFloor/FUNIT;
+        ceil = ceil < min ? min : ceil > max ? max : ceil;
+        floor = floor < min ? min : floor > max ? max : floor;
+        if ((portalMin[x] > ceil || portalMax[x] < floor) && iz > columnNearest[x])
+            columnNearest[x] = iz;
+    }
+}
+#endif
+
+// Narrow a window to its first and last open columns (min < max), return 0 if
+// there are none.
+IWRAM_CODE
+ARM_TARGET
+static inline int trimWindow(int * xMin, int * xMax, YCB minYCB, YCB maxYCB) {
+    int x1 = *xMin, x2 = *xMax;
+    while (x1 < x2 && minYCB[x1] >= maxYCB[x1])
+        x1++;
+    while (x2 > x1 && minYCB[x2 - 1] >= maxYCB[x2 - 1])
+        x2--;
+    *xMin = x1;
+    *xMax = x2;
+    return x2 > x1;
+}
+
+// bits of columns xMin to xMax - 1 in word w of a ColumnMask
+static inline u32 columnBits(int w, int xMin, int xMax) {
+    int lo = xMin - w * 32, hi = xMax - w * 32;
+    if (lo < 0)
+        lo = 0;
+    if (hi > 32)
+        hi = 32;
+    if (hi <= lo)
+        return 0;
+    return (hi == 32 ? ~0u : (1u << hi) - 1) & ~((1u << lo) - 1);
+}
+
+// fill in the open columns of a window, return 0 if there are none
+IWRAM_CODE
+ARM_TARGET
+static inline int openColumns(int xMin, int xMax, YCB minYCB, YCB maxYCB, ColumnMask open) {
+    u32 any = 0;
+    for (int w = 0; w < COLUMN_MASK_WORDS; w++) {
+        u32 bits = 0;
+        int x1 = w * 32 > xMin ? w * 32 : xMin;
+        int x2 = w * 32 + 32 < xMax ? w * 32 + 32 : xMax;
+        for (int x = x1; x < x2; x++) {
+            if (minYCB[x] < maxYCB[x])
+                bits |= 1u << (x & 31);
+        }
+        open[w] = bits;
+        any |= bits;
+    }
+    return any != 0;
+}
+
+// mark columns xMin to xMax - 1 drawn, return 0 if none are left open
+IWRAM_CODE
+ARM_TARGET
+static inline int closeColumns(ColumnMask open, int xMin, int xMax) {
+    u32 any = 0;
+    for (int w = 0; w < COLUMN_MASK_WORDS; w++) {
+        open[w] &= ~columnBits(w, xMin, xMax);
+        any |= open[w];
+    }
+    return any != 0;
+}
+
+// write count hwords down a column
+IWRAM_CODE
+ARM_TARGET
+static inline void columnFill(u16 * dst, int count, int color) {
+    for (; count >= 4; count -= 4) {
+        dst[0] = color;
+        dst[COLUMN_STEP] = color;
+        dst[COLUMN_STEP*2] = color;
+        dst[COLUMN_STEP*3] = color;
+        dst += COLUMN_STEP*4;
+    }
+    for (; count > 0; count--) {
+        *dst = color;
+        dst += COLUMN_STEP;
+    }
+}
+
+// write count hwords along a row, using CpuFastSet for the aligned middle
+IWRAM_CODE
+ARM_TARGET
+static void rowFill(u16 * dst, int count, int color) {
+#ifdef SCRATCH_BUFFER
+    // rows aren't contiguous in the scratch buffer
+    for (; count > 0; count--, dst += ROW_STEP)
+        *dst = color;
+#else
+    if ((uintptr_t)dst & 2) {
+        *dst++ = color;
+        count--;
+    }
+    u32 fill = color | (color << 16);
+    int words = count / 2;
+    // CpuFastSet works in blocks of 8 words
+    int fastWords = words & ~7;
+    if (fastWords)
+        CpuFastSet(&fill, dst, fastWords | (1<<24));
+    u32 * dstW = (u32 *)dst + fastWords;
+    for (int i = fastWords; i < words; i++)
+        *dstW++ = fill;
+    if (count & 1)
+        *(u16 *)dstW = color;
+#endif
+}
+
+// fill rows y1 to y2 of column x, return number of hwords written
+IWRAM_CODE
+ARM_TARGET
+static inline int spanFill(int x, int y1, int y2, int color) {
+    if (y2 <= y1)
+        return 0;
+    columnFill(PIXEL(x, y1), y2 - y1, color);
+    return y2 - y1;
+}
+
+// Fill the walls of a run of columns and record their floor and ceiling.
+// Ceiling is above EDGE_CEIL, floor is below EDGE_FLOOR, and wall fills the
+// rest except for the portal window between EDGE_PORTAL_TOP and
+// EDGE_PORTAL_BOTTOM.
+IWRAM_CODE
+ARM_TARGET
+static void wallFill(int xDrawMin, int xDrawMax, const Edge * edges,
+        YCB minYCB, YCB maxYCB, int wallColor, s32 iz, s32 izStep, int light) {
+    PROFILE_BEGIN(start);
+    fixed yCeil = edges[EDGE_CEIL].y, yTop = edges[EDGE_PORTAL_TOP].y;
+    fixed yBottom = edges[EDGE_PORTAL_BOTTOM].y, yFloor = edges[EDGE_FLOOR].y;
+    for (int x = xDrawMin; x < xDrawMax; x++) {
+        int min = minYCB[x], max = maxYCB[x];
+        int y[NUM_EDGES] = {yCeil/FUNIT, yTop/FUNIT, yBottom/FUNIT, yFloor/FUNIT};
+        for (int i = 0; i < NUM_EDGES; i++) {
+            if (y[i] < min)
+                y[i] = min;
+            if (y[i] > max)
+                y[i] = max;
+        }
+        // if the edges cross, floor wins over ceiling
+        ceilPlane.top[x] = min;
+        ceilPlane.bottom[x] = y[EDGE_CEIL] < y[EDGE_FLOOR] ? y[EDGE_CEIL] : y[EDGE_FLOOR];
+        floorPlane.top[x] = y[EDGE_FLOOR];
+        floorPlane.bottom[x] = max;
+        int color = lightMap(light, iz)[wallColor & 0xFF];
+        int pixels = 0;
+        pixels += spanFill(x, y[EDGE_CEIL], y[EDGE_PORTAL_TOP], color);
+        pixels += spanFill(x, y[EDGE_PORTAL_BOTTOM], y[EDGE_FLOOR], color);
+        STAT_ADD(pixels, 2 * pixels);
+        iz += izStep;
+        yCeil += edges[EDGE_CEIL].slope;
+        yTop += edges[EDGE_PORTAL_TOP].slope;
+        yBottom += edges[EDGE_PORTAL_BOTTOM].slope;
+        yFloor += edges[EDGE_FLOOR].slope;
+    }
+    PROFILE_END(start, PROF_SOLID);
+}
+
+// Textured row of a flat from column x1 to x2. Rows are at a constant
+// distance, so the texture steps linearly along them.
+IWRAM_CODE
+ARM_TARGET
+static void flatSpan(int y, int x1, int x2, fixed z, Texture texture,
+        const u16 * shade, fixed sint, fixed cost) {
+    // distance to the flat through the middle of the row, z / dist is the
+    // inverse of projectZ
+    fixed dy = y*FUNIT + FUNIT/2 - HORIZON*FUNIT;
+    if ((dy < 0) == (z < 0))
+        return;
+    s32 rowRecip = FRECIP_FAST(ABS(dy));
+    fixed dist = FMULT(ABS(z) * 128, rowRecip);
+    // world position of the middle of column x1, in 16 bit fractions:
+    // dist forward and (M4WIDTH/2 - x) * dist/64 to the left (see projectXY)
+    s64 side = ((s64)(M4WIDTH/2*FUNIT - x1*FUNIT - FUNIT/2) * dist) >> 6;
+    s64 worldX = ((s64)camX << FPOINT) + (s64)dist * cost - ((side * sint) >> FPOINT);
+    s64 worldY = ((s64)camY << FPOINT) + (s64)dist * sint + ((side * cost) >> FPOINT);
+    // texels in 16.16, wrapping is fine since the texture repeats
+    int uScale = texture.widthPwr - TEXTURE_REPEAT_PWR;
+    int vScale = texture.heightPwr - TEXTURE_REPEAT_PWR;
+    u32 u = (u32)(worldX << uScale), v = (u32)(worldY << vScale);
+    u32 uStep = (u32)((((s64)dist * sint) << uScale) >> 6);
+    u32 vStep = (u32)(-((((s64)dist * cost) << vScale) >> 6));
+    int uMask = (1 << texture.widthPwr) - 1;
+    int vMask = (1 << texture.heightPwr) - 1;
+    u16 * dst = PIXEL(x1, y);
+    for (int x = x1; x < x2; x++, u += uStep, v += vStep, dst += ROW_STEP)
+        *dst = shade[texture.data[(((v >> 16) & vMask) << texture.widthPwr) + ((u >> 16) & uMask)] & 0xFF];
+}
+
+IWRAM_CODE
+ARM_TARGET
+static inline void flatRow(int y, int x1, int x2, fixed z, int fillType, int fillNum,
+        Texture texture, int light, fixed sint, fixed cost) {
+    // 1/z of the row is 512 * dy / z, see flatSpan
+    fixed dy = y*FUNIT + FUNIT/2 - HORIZON*FUNIT;
+    s32 iz = z != 0 && (dy < 0) != (z < 0) ? FDIV_FAST(ABS(dy) * 2, ABS(z)) << IZ_SHIFT : 0;
+    const u16 * shade = lightMap(light, iz);
+    if (fillType == FILL_TEXTURE) {
+        flatSpan(y, x1, x2, z, texture, shade, sint, cost);
+        textureUse[fillNum] += x2 - x1;
+    } else
+        rowFill(PIXEL(x1, y), x2 - x1, shade[fillNum & 0xFF]);
+    STAT_ADD(pixels, 2 * (x2 - x1));
+}
+
+// Draw a floor or ceiling as rows: sweep across the columns, starting a span
+// on rows which the column covers and the last one didn't, and ending it on
+// rows which the last column covered and this one doesn't.
+IWRAM_CODE
+ARM_TARGET
+static void drawFlat(const FlatPlane * plane, int xMin, int xMax, fixed z,
+        int fillType, int fillNum, int light, fixed sint, fixed cost) {
+    PROFILE_BEGIN(start);
+    static u8 spanStart[SCREEN_HEIGHT];
+    Texture texture = textures[fillType == FILL_TEXTURE ? fillNum : 0];
+    int t1 = 0, b1 = 0;
+    for (int x = xMin; x <= xMax; x++) {
+        int t2 = 0, b2 = 0;
+        if (x < xMax && plane->top[x] < plane->bottom[x]) {
+            t2 = plane->top[x];
+            b2 = plane->bottom[x];
+        }
+        // rows of the last column not in this one
+        for (int y = t1; y < (b1 < t2 ? b1 : t2); y++)
+            flatRow(y, spanStart[y], x, z, fillType, fillNum, texture, light, sint, cost);
+        for (int y = t1 > b2 ? t1 : b2; y < b1; y++)
+            flatRow(y, spanStart[y], x, z, fillType, fillNum, texture, light, sint, cost);
+        // rows of this column not in the last one
+        for (int y = t2; y < (b2 < t1 ? b2 : t1); y++)
+            spanStart[y] = x;
+        for (int y = t2 > b1 ? t2 : b1; y < b2; y++)
+            spanStart[y] = x;
+        t1 = t2;
+        b1 = b2;
+    }
+    PROFILE_END(start, PROF_FLAT);
+}
+
+// 1/z << IZ_SHIFT across a wall, from column xDrawMin
+// Screen width of a wall, for stepping across it. Walls seen edge on can be
+// thinner than a column, and dividing by that would overflow the steps;
+// their columns are all within a pixel of the ends anyway.
+static inline fixed wallWidth(fixed scrX1, fixed scrX2) {
+    fixed width = scrX2 - scrX1;
+    return width > FUNIT ? width : FUNIT;
+}
+
+IWRAM_CODE
+ARM_TARGET
+static inline void inverseDepth(fixed scrX1, fixed scrX2, fixed x1recip, fixed x2recip,
+        int xDrawMin, s32 * izOut, s32 * izStepOut) {
+    s32 iz1 = x1recip << IZ_SHIFT, iz2 = x2recip << IZ_SHIFT;
+    *izStepOut = FDIV_FAST(iz2 - iz1, wallWidth(scrX1, scrX2));
+    *izOut = iz1 + (((s64)*izStepOut * (xDrawMin*FUNIT - scrX1)) >> FPOINT);
+}
+
+IWRAM_CODE
+ARM_TARGET
+static inline void textureMapping(fixed scrX1, fixed scrX2,
+        fixed x1recip, fixed x2recip, fixed u1, fixed u2, int xDrawMin, TexMapping * out) {
+    // u/z is largest at the nearer end, so u is made small there by taking
+    // off whole texture periods, which don't change the texel. Within the
+    // frustum u/z then stays under about 2/z + 3, so uz fits in an s32 for any
+    // wall length.
+    fixed base = (x1recip > x2recip ? u1 : u2) & ~((FUNIT << TEXTURE_REPEAT_PWR) - 1);
+    u1 -= base;
+    u2 -= base;
+    s32 uz1 = u1 * x1recip, uz2 = u2 * x2recip;
+    fixed width = wallWidth(scrX1, scrX2);
+    fixed offset = xDrawMin*FUNIT - scrX1;
+    inverseDepth(scrX1, scrX2, x1recip, x2recip, xDrawMin, &out->iz, &out->izStep);
+    out->uzStep = FDIV_FAST(uz2 - uz1, width);
+    out->uz = uz1 + (((s64)out->uzStep * offset) >> FPOINT);
+}
+
+// perspective divide
+IWRAM_CODE
+ARM_TARGET
+static inline fixed textureU(s32 uz, s32 iz) {
+    if (iz <= 0)
+        iz = 1;
+    return FDIV_FAST(uz, iz);
+}
+
+// Fill rows y to max of column x from a column of 2^heightPwr texels, a texel
+// row being 2^widthPwr hwords, stretched over lHeight rows from curY1. Always
+// inlined with constant sizes so the shifts are immediates, see
+// textureColumnKernels.
+static inline FORCE_INLINE void textureColumnSized(int x, int y, int max,
+        int curY1, int lHeight, const u16 * column, const u16 * shade,
+        int widthPwr, int heightPwr) {
+    // Rows are in 1/2^heightPwr steps here, texel texV ends at yyy. The first
+    // one reaching row y is estimated with a divide by lHeight, which is a
+    // multiply by its reciprocal, and is a texel off at most.
+    int yMin = y << heightPwr;
+    int texV = FDIV_FAST((y - curY1) << heightPwr, lHeight) >> FPOINT;
+    int yyy = (curY1 << heightPwr) + (texV + 1) * lHeight;
+    if (texV > 0 && yyy - lHeight >= yMin) {
+        texV--;
+        yyy -= lHeight;
+    } else if (yyy < yMin) {
+        texV++;
+        yyy += lHeight;
+    }
+    int maxYYY = max << heightPwr;
+    for (; yyy < maxYYY; yyy += lHeight) {
+        int color = shade[column[texV << widthPwr] & 0xFF];
+        int texelMax = yyy >> heightPwr;
+        if (texelMax > y) {
+            columnFill(PIXEL(x, y), texelMax - y, color);
+            y = texelMax;
+        }
+        texV++;
+    }
+    // fill in the last texel separately
+    int finalColor = shade[column[texV << widthPwr] & 0xFF];
+    if (max > y)
+        columnFill(PIXEL(x, y), max - y, finalColor);
+}
+
+// a textureColumnSized for one texture size
+typedef void (*TextureColumnKernel)(int x, int y, int max,
+    int curY1, int lHeight, const u16 * column, const u16 * shade);
+
+#define TEXTURE_COLUMN_KERNEL(pwr, attributes) \
+    attributes \
+    static void textureColumn##pwr(int x, int y, int max, \
+            int curY1, int lHeight, const u16 * column, const u16 * shade) { \
+        textureColumnSized(x, y, max, curY1, lHeight, column, shade, pwr, pwr); \
+    }
+
+// Only the sizes the textures have: 2^5 texels, and their mips down to 2^2.
+// Full size and the first mip are drawn the most and go in IWRAM, the small
+// mips are for walls a few pixels tall and stay in ROM.
+TEXTURE_COLUMN_KERNEL(2, )
+TEXTURE_COLUMN_KERNEL(3, )
+TEXTURE_COLUMN_KERNEL(4, IWRAM_CODE ARM_TARGET)
+TEXTURE_COLUMN_KERNEL(5, IWRAM_CODE ARM_TARGET)
+
+// square textures and mips of 2^TEXTURE_KERNEL_MIN_PWR to
+// 2^TEXTURE_KERNEL_MAX_PWR texels have their own kernel, indexed by size
+#define TEXTURE_KERNEL_MIN_PWR 2
+#define TEXTURE_KERNEL_MAX_PWR 5
+static const TextureColumnKernel textureColumnKernels[] = {
+    textureColumn2, textureColumn3, textureColumn4, textureColumn5
+};
+
+// any other size, rare enough to stay in ROM
+static void textureColumnAny(int x, int y, int max,
+        int curY1, int lHeight, const u16 * column, const u16 * shade,
+        int widthPwr, int heightPwr) {
+    textureColumnSized(x, y, max, curY1, lHeight, column, shade, widthPwr, heightPwr);
+}
+
+// Each column is drawn from the largest mip with no more texels than it has
+// rows. Return the number of hwords drawn.
+IWRAM_CODE
+ARM_TARGET
+static int textureFill(int xDrawMin, int xDrawMax,
+        fixed yStart1, fixed slope1, fixed yStart2, fixed slope2,
+        YCB minYCB, YCB maxYCB, TexMapping mapping, Texture texture, int light) {
+    PROFILE_BEGIN(start);
+    int uShift = FPOINT + TEXTURE_REPEAT_PWR - texture.widthPwr;
+    int uMask = (1 << texture.widthPwr) - 1;
+    int maxMip = texture.widthPwr < texture.heightPwr ? texture.widthPwr : texture.heightPwr;
+    if (maxMip > TEXTURE_MIPS)
+        maxMip = TEXTURE_MIPS;
+    int square = texture.widthPwr == texture.heightPwr
+        && texture.heightPwr <= TEXTURE_KERNEL_MAX_PWR
+        && texture.heightPwr - maxMip >= TEXTURE_KERNEL_MIN_PWR;
+    int mipPwr = texture.heightPwr + mipBias;
+    s32 iz = mapping.iz, uz = mapping.uz;
+    fixed u = textureU(uz, iz), uStep = 0;
+    fixed y1 = yStart1, y2 = yStart2;
+    // iz runs a span ahead, this is the column's own for its light
+    s32 columnIz = mapping.iz;
+    int drawn = 0;
+    for (int x = xDrawMin; x < xDrawMax;
+            x++, u += uStep, y1 += slope1, y2 += slope2, columnIz += mapping.izStep) {
+        if (((x - xDrawMin) & (TEX_SPAN-1)) == 0) {
+            // exact u at the end of the next span, linear in between
+            int span = xDrawMax - x;
+            if (span > TEX_SPAN)
+                span = TEX_SPAN;
+            iz += mapping.izStep * span;
+            uz += mapping.uzStep * span;
+            fixed uNext = textureU(uz, iz);
+            uStep = span == TEX_SPAN ? (uNext - u) >> TEX_SPAN_PWR : (uNext - u) / span;
+        }
+
+        int y = minYCB[x], max = maxYCB[x];
+        int curY1 = y1/FUNIT, curY2 = y2/FUNIT;
+        int lHeight = curY2 - curY1;
+        if (curY1 > y)
+            y = curY1;
+        if (curY2 < max)
+            max = curY2;
+        if (y >= max)
+            continue;
+        drawn += max - y;
+        STAT_ADD(pixels, 2 * (max - y));
+
+        int mip = 0;
+        while (mip < maxMip && lHeight < 1 << (mipPwr - mip))
+            mip++;
+        STAT_ADD(mipColumns, mip > 0);
+        const u16 * data = mip ? texture.mips[mip - 1] : texture.data;
+        const u16 * column = data + ((u >> (uShift + mip)) & (uMask >> mip));
+        const u16 * shade = lightMap(light, columnIz);
+        if (square)
+            textureColumnKernels[texture.heightPwr - mip - TEXTURE_KERNEL_MIN_PWR](x, y, max,
+                curY1, lHeight, column, shade);
+        else
+            textureColumnAny(x, y, max, curY1, lHeight, column, shade,
+                texture.widthPwr - mip, texture.heightPwr - mip);
+    }
+    PROFILE_END(start, PROF_TEXTURE);
+    return drawn;
+}
+
+// Draw the sprites in front of the camera from back to front, each clipped to
+// the windows its sector was drawn in.
+IWRAM_CODE
+ARM_TARGET
+static void drawSprites(fixed sint, fixed cost) {
+    PROFILE_BEGIN(start);
+    static ViewSprite visible[MAX_VISIBLE_SPRITES];
+    int count = 0;
+    for (int i = 0; i < spriteCount && count < MAX_VISIBLE_SPRITES; i++) {
+        const Sprite * sprite = spriteList + i;
+        fixed x, y;
+        rotatePoint(sprite->x - camX, sprite->y - camY, -sint, cost, &x, &y);
+        if (x < SPRITE_NEAR || sprite->sector < 0)
+            continue;
+        // insertion sort, farthest first; there are only a few
+        int j = count++;
+        for (; j > 0 && visible[j - 1].x < x; j--)
+            visible[j] = visible[j - 1];
+        visible[j] = (ViewSprite){sprite, x, y};
+    }
+    STAT_ADD(sprites, count);
+    for (int i = 0; i < count; i++)
+        drawSprite(visible + i);
+    PROFILE_END(start, PROF_SPRITE);
+}
+
+// Scale a sprite's texture onto the screen. Texels per column and per row are
+// proportional to depth, so the steps come from one division each.
+IWRAM_CODE
+ARM_TARGET
+static void drawSprite(const ViewSprite * view) {
+    const Sprite * sprite = view->sprite;
+    Texture texture = textures[sprite->texture];
+    fixed recip = FRECIP_FAST(view->x);
+    // top and bottom are at the same depth, so only one of each pair is needed
+    int scrX1, scrX2, scrY1, scrY2, unused;
+    projectXY(recip, view->y + sprite->width/2, recip, view->y - sprite->width/2,
+        &scrX1, &scrX2);
+    projectZ(recip, recip, sprite->z + sprite->height - camZ, &scrY1, &unused);
+    projectZ(recip, recip, sprite->z - camZ, &scrY2, &unused);
+    // columns and rows starting inside the sprite, like walls
+    int xDrawMin = (scrX1 + FUNIT - 1) >> FPOINT, xDrawMax = (scrX2 + FUNIT - 1) >> FPOINT;
+    int yDrawMin = (scrY1 + FUNIT - 1) >> FPOINT, yDrawMax = (scrY2 + FUNIT - 1) >> FPOINT;
+    if (xDrawMax <= 0 || xDrawMin >= M4WIDTH || yDrawMax <= 0 || yDrawMin >= SCREEN_HEIGHT)
+        return;
+
+    // texels in 16.16: the sprite is 64 * width / x hwords wide (see
+    // projectXY) and 128 * height / x rows tall (see projectZ)
+    u32 uStep = FDIV_FAST(view->x << (texture.widthPwr + 2), sprite->width);
+    u32 vStep = FDIV_FAST(view->x << (texture.heightPwr + 1), sprite->height);
+    u32 uStart = ((s64)(xDrawMin*FUNIT - scrX1) * uStep) >> FPOINT;
+    u32 vStart = ((s64)(yDrawMin*FUNIT - scrY1) * vStep) >> FPOINT;
+    int uMask = (1 << texture.widthPwr) - 1, vMask = (1 << texture.heightPwr) - 1;
+
+    s32 iz = recip << IZ_SHIFT;
+    const Sector * sector = map.sectors + sprite->sector;
+    const u16 * shade = lightMap(sector->light, iz);
+    for (int w = 0; w < drawnCount; w++) {
+        const PortalWindow * window = drawnWindows + w;
+        if (window->sector != sector)
+            continue;
+        int xMin = xDrawMin > window->xClipMin ? xDrawMin : window->xClipMin;
+        int xMax = xDrawMax < window->xClipMax ? xDrawMax : window->xClipMax;
+        u32 u = uStart + (xMin - xDrawMin) * uStep;
+        for (int x = xMin; x < xMax; x++, u += uStep) {
+#ifdef COLUMN_DEPTH
+            // walls of its own sector can still be in front of the sides
+            if (columnDepth[x] >= iz)
+                continue;
+#endif
+            int y1 = window->minYCB[x], y2 = window->maxYCB[x];
+            if (yDrawMin > y1)
+                y1 = yDrawMin;
+            if (yDrawMax < y2)
+                y2 = yDrawMax;
+            if (y1 >= y2)
+                continue;
+            textureUse[sprite->texture] += y2 - y1;
+            const u16 * column = texture.data + ((u >> 16) & uMask);
+            u32 v = vStart + (y1 - yDrawMin) * vStep;
+            u16 * dst = PIXEL(x, y1);
+            for (int y = y1; y < y2; y++, v += vStep, dst += COLUMN_STEP) {
+                int color = column[((v >> 16) & vMask) << texture.widthPwr];
+                if (color) {
+                    *dst = shade[color & 0xFF];
+                    STAT_ADD(pixels, 2);
+                }
+            }
+        }
+    }
+}
+
+#ifdef COLUMN_DEPTH
+fixed wallDistance(int x) {
+    if (x < 0 || x >= M4WIDTH || columnNearest[x] <= 0)
+        return 0;
+    return ((s64)1 << (FPOINT2 + IZ_SHIFT)) / columnNearest[x];
+}
+
+int inFrontOfWall(fixed x, fixed y) {
+    fixed depth, side;
+    rotatePoint(x - viewX, y - viewY, -viewSin, viewCos, &depth, &side);
+    if (depth <= 0)
+        return 0;
+    fixed recip = FRECIP_FAST(depth);
+    int scrX, unused;
+    projectXY(recip, side, recip, side, &scrX, &unused);
+    int column = scrX >> FPOINT;
+    if (column < 0 || column >= M4WIDTH)
+        return 0;
+    return (recip << IZ_SHIFT) > columnNearest[column];
+}
+#endif
+
+#ifdef SCRATCH_BUFFER
+// Transpose the scratch buffer onto the page. A word read from a column holds
+// two rows of it, so rows are done in pairs, which is also a whole number of
+// CpuFastSet blocks.
+IWRAM_CODE
+ARM_TARGET
+static void blitScratch(void) {
+    PROFILE_BEGIN(start);
+    static u32 rows[M4WIDTH];
+    for (int y = 0; y < SCREEN_HEIGHT; y += 2) {
+        const u32 * src = (const u32 *)PIXEL(0, y);
+        for (int x = 0; x < M4WIDTH / 2; x++, src += SCREEN_HEIGHT) {
+            u32 left = src[0], right = src[SCREEN_HEIGHT / 2];
+            rows[x] = (left & 0xFFFF) | (right << 16);
+            rows[M4WIDTH / 2 + x] = (left >> 16) | (right & 0xFFFF0000);
+        }
+        CpuFastSet(rows, frameBuffer[y], M4WIDTH);
+    }
+    PROFILE_END(start, PROF_BLIT);
+}
+#endif
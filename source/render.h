@@ -0,0 +1,110 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "platform.h"
+#include "fixed.h"
+#include "map.h"
+
+//#define DEBUG_LINES
+// COLUMN_DEPTH (set by building with DEPTH=1) keeps the depth of the wall
+// closing each screen column, for hiding sprites behind walls of their own
+// sector, and of the nearest wall drawn in it, portal steps included, for
+// hit-scan queries. Two words per column, filled in as the walls are drawn.
+// Without it sprites are only clipped to their sector's windows.
+// SCRATCH_BUFFER (set by building with SCRATCH=1) draws the frame column-major
+// into a scratch buffer and copies it to the page at the end, instead of
+// writing the page a column at a time. It's off by default: on the GBA the
+// buffer is in EWRAM, whose hword stores take 3 cycles to VRAM's 1, flats lose
+// CpuFastSet because rows are strided there, and the copy to the page is a
+// full-screen transpose on top. Time it on hardware (PROFILE=1, see the blit
+// stage) before turning it on; the host bench doesn't model wait states.
+
+#define M4WIDTH 120
+typedef u16 MODE4_LINE[M4WIDTH];
+#define MODE4_FB ((MODE4_LINE *)VRAM)
+// second page, shown while DISPCNT's page bit (BACKBUFFER) is set
+#define MODE4_BACK_FB ((MODE4_LINE *)(VRAM + 0xA000))
+
+#define HORIZON 80
+
+// halvings of a texture kept for drawing it small, see texcache.h
+#define TEXTURE_MIPS 3
+
+typedef struct {
+    int widthPwr, heightPwr;
+    const u16 * data;
+    // mips[m] is 2^(m+1) times smaller each way, down to a texel wide or tall
+    const u16 * mips[TEXTURE_MIPS];
+    u16 average;    // closest color to the whole texture, as a solid fill
+} Texture;
+
+#define NUM_TEXTURES 3
+// unpacked copies in RAM, see texcache.h
+extern Texture textures[NUM_TEXTURES];
+
+// A billboard standing in the map, always facing the camera. Texels of color
+// 0 are transparent.
+typedef struct {
+    fixed x, y, z;          // middle of the bottom edge
+    fixed width, height;
+    int sector;             // sector containing (x, y), see findSector
+    int texture;
+} Sprite;
+
+// Counters for the benchmark harness, compiled out unless RENDER_STATS is set
+#ifdef RENDER_STATS
+typedef struct {
+    int pixels;     // pixels written to the framebuffer
+    int walls;      // walls tested by drawSector
+    int vertices;   // vertices transformed to camera space
+    int sectors;    // drawSector calls
+    int ycbPeak;    // high-water mark of the portal clip buffer arena, hwords
+    int portalsDropped; // portals drawn as walls because a limit was hit
+    int pvsCulled;  // portals into sectors outside the PVS
+    int sprites;    // sprites in front of the camera
+    int texturesPromoted; // textures copied into IWRAM
+    int lodWalls;   // textured walls drawn in their average color
+    int wallsSkipped; // walls not tested because their window was covered
+    int windowsClosed; // portals not drawn because nothing shows through
+    int mipColumns; // texture columns drawn from a mip
+} RenderStats;
+extern RenderStats renderStats;
+#define STAT_ADD(field, n) (renderStats.field += (n))
+#else
+#define STAT_ADD(field, n)
+#endif
+
+extern fixed camX, camY, camZ;
+
+// call once after loading each map
+void initRenderer(void);
+// page for the following frames to be drawn to, MODE4_FB by default
+void setRenderTarget(MODE4_LINE * target);
+// sprites for the following frames to draw, read each frame so they can be
+// moved in place
+void setSprites(const Sprite * sprites, int count);
+// draw a full frame from the camera, which must be inside sector
+void drawFrame(const Sector * sector, fixed sint, fixed cost);
+
+// Textured walls whose nearest point is farther than this from the camera
+// plane are drawn in their average color. Walls come back textured only once
+// they're an eighth of that nearer, so they don't flicker at the threshold.
+// 0 always draws textures.
+#define LOD_DISTANCE (16*FUNIT)
+// LOD_DISTANCE until changed
+void setLodDistance(fixed distance);
+// Textured columns pick their mip as if they were 2^bias times shorter, so
+// walls too near to need mips still draw from them. 0 until changed, and
+// negative biases are taken as 0.
+void setMipBias(int bias);
+
+#ifdef COLUMN_DEPTH
+// distance from the camera plane to the nearest wall drawn in column x (in
+// hwords) of the last frame, 0 if there was none
+fixed wallDistance(int x);
+// whether the point (x, y) was on screen in the last frame and in front of
+// every wall drawn in its column, so a shot from the camera would reach it
+int inFrontOfWall(fixed x, fixed y);
+#endif
+
+#endif
@@ -0,0 +1,165 @@
+#include "texcache.h"
+#include "light.h"
+#include "textures_lz.h"
+
+// where a texture comes from: hwords into a sheet
+typedef struct {
+    int sheet, offset;
+    int widthPwr, heightPwr;
+} TextureSource;
+
+static const TextureSheet sheets[] = {
+    {texturesLz, texturesBitmapLen, 1}
+};
+#define NUM_SHEETS (sizeof(sheets) / sizeof(sheets[0]))
+
+static const TextureSource sources[NUM_TEXTURES] = {
+    {0, 0, 5, 5},
+    {0, 1024, 5, 5},
+    {0, 2048, 5, 5}
+};
+
+Texture textures[NUM_TEXTURES];
+u32 textureUse[NUM_TEXTURES];
+
+// The sheets unpacked, in whole CpuFastSet blocks, then the mips. Each level
+// is a quarter of the one before, so a texture's mips come to under a third
+// of it, plus rounding each up to a block.
+#define SHEET_BYTES ((texturesBitmapLen + 31) & ~31)
+#define EWRAM_CACHE_SIZE (SHEET_BYTES + SHEET_BYTES / 3 + NUM_TEXTURES * TEXTURE_MIPS * 32)
+EWRAM_BSS static u32 ewramCache[EWRAM_CACHE_SIZE / 4];
+// .bss is in IWRAM on the GBA
+static u32 iwramSlot[TEXCACHE_SLOT_SIZE / 4];
+static u32 mipPool[TEXCACHE_MIP_IWRAM_SIZE / 4];
+
+// each texture's unpacked copy in EWRAM
+static const u16 * ewramData[NUM_TEXTURES];
+// texture in the slot or -1
+static int slotTexture;
+
+// bytes of a texture level, in whole CpuFastSet blocks
+static u32 levelSize(int widthPwr, int heightPwr) {
+    return ((2 << (widthPwr + heightPwr)) + 31) & ~31;
+}
+
+// shrink a level of 2^widthPwr by 2^heightPwr texels to half each way
+static void buildMip(const u16 * src, u16 * dest, int widthPwr, int heightPwr) {
+    int width = 1 << widthPwr;
+    for (int y = 0; y < 1 << (heightPwr - 1); y++) {
+        for (int x = 0; x < width / 2; x++) {
+            const u16 * texel = src + ((y * 2) << widthPwr) + x * 2;
+            int index = averageColor(texel[0] & 0xFF, texel[1] & 0xFF,
+                texel[width] & 0xFF, texel[width + 1] & 0xFF);
+            dest[(y << (widthPwr - 1)) + x] = index | (index << 8);
+        }
+    }
+}
+
+// texels of the levels averageTexture shrinks the smallest mip through
+#define AVERAGE_TEXELS 64
+
+// a texture's closest color, from its smallest mip shrunk to a texel
+static u16 averageTexture(const Texture * texture) {
+    const u16 * level = texture->data;
+    int widthPwr = texture->widthPwr, heightPwr = texture->heightPwr;
+    for (int m = 0; m < TEXTURE_MIPS && texture->mips[m]; m++) {
+        level = texture->mips[m];
+        widthPwr--;
+        heightPwr--;
+    }
+    u16 buffers[2][AVERAGE_TEXELS];
+    for (int b = 0; widthPwr > 0 && heightPwr > 0; b ^= 1) {
+        // textures too big for the mips to get this small just use a texel
+        if (1 << (widthPwr + heightPwr - 2) > AVERAGE_TEXELS)
+            return level[0];
+        buildMip(level, buffers[b], widthPwr, heightPwr);
+        level = buffers[b];
+        widthPwr--;
+        heightPwr--;
+    }
+    return level[0];
+}
+
+int initTextureCache(void) {
+    const u16 * sheetData[NUM_SHEETS];
+    u32 used = 0;
+    for (int s = 0; s < NUM_SHEETS; s++) {
+        // CpuFastSet copies in blocks of 8 words
+        u32 size = (sheets[s].size + 31) & ~31;
+        if (used + size > EWRAM_CACHE_SIZE)
+            return 0;
+        u32 * dest = ewramCache + used / 4;
+        if (sheets[s].compressed)
+            LZ77UnCompWram(sheets[s].data, dest);
+        else
+            CpuFastSet(sheets[s].data, dest, size / 4);
+        sheetData[s] = (const u16 *)dest;
+        used += size;
+    }
+    for (int t = 0; t < NUM_TEXTURES; t++) {
+        const TextureSource * source = sources + t;
+        ewramData[t] = sheetData[source->sheet] + source->offset;
+        textures[t] = (Texture){source->widthPwr, source->heightPwr, ewramData[t]};
+        textureUse[t] = 0;
+    }
+    // mips go after the sheets
+    for (int t = 0; t < NUM_TEXTURES; t++) {
+        const u16 * level = ewramData[t];
+        int widthPwr = textures[t].widthPwr, heightPwr = textures[t].heightPwr;
+        for (int m = 0; m < TEXTURE_MIPS; m++) {
+            textures[t].mips[m] = 0;
+            if (widthPwr == 0 || heightPwr == 0)
+                continue;
+            u32 size = levelSize(widthPwr - 1, heightPwr - 1);
+            if (used + size > EWRAM_CACHE_SIZE)
+                return 0;
+            u16 * dest = (u16 *)(ewramCache + used / 4);
+            buildMip(level, dest, widthPwr, heightPwr);
+            textures[t].mips[m] = level = dest;
+            used += size;
+            widthPwr--;
+            heightPwr--;
+        }
+    }
+    for (int t = 0; t < NUM_TEXTURES; t++)
+        textures[t].average = averageTexture(textures + t);
+    u32 mipPoolUsed = 0;
+    for (int m = TEXTURE_MIPS - 1; m >= 0; m--) {
+        for (int t = 0; t < NUM_TEXTURES; t++) {
+            if (!textures[t].mips[m])
+                continue;
+            u32 size = levelSize(textures[t].widthPwr - m - 1, textures[t].heightPwr - m - 1);
+            if (mipPoolUsed + size > TEXCACHE_MIP_IWRAM_SIZE)
+                continue;
+            u32 * dest = mipPool + mipPoolUsed / 4;
+            CpuFastSet(textures[t].mips[m], dest, size / 4);
+            textures[t].mips[m] = (const u16 *)dest;
+            mipPoolUsed += size;
+        }
+    }
+    slotTexture = -1;
+    return 1;
+}
+
+void updateTextureCache(void) {
+    int hottest = 0;
+    for (int t = 1; t < NUM_TEXTURES; t++) {
+        if (textureUse[t] > textureUse[hottest])
+            hottest = t;
+    }
+    u32 drawn = textureUse[hottest];
+    for (int t = 0; t < NUM_TEXTURES; t++)
+        textureUse[t] = 0;
+    if (!drawn || hottest == slotTexture)
+        return;
+    int bytes = 2 << (textures[hottest].widthPwr + textures[hottest].heightPwr);
+    if (bytes > TEXCACHE_SLOT_SIZE)
+        return;
+
+    if (slotTexture >= 0)
+        textures[slotTexture].data = ewramData[slotTexture];
+    CpuFastSet(ewramData[hottest], iwramSlot, bytes / 4);
+    textures[hottest].data = (const u16 *)iwramSlot;
+    slotTexture = hottest;
+    STAT_ADD(texturesPromoted, 1);
+}
@@ -0,0 +1,39 @@
+#ifndef TEXCACHE_H
+#define TEXCACHE_H
+
+#include "platform.h"
+#include "render.h"
+
+// Textures are stored in ROM as grit bitmaps, either raw or LZ77 compressed
+// (the texture sheet is compressed at build time by tools/texc).
+// initTextureCache unpacks them all into EWRAM, and after each frame the
+// texture drawn the most is copied into the IWRAM slot, if it isn't there
+// already, so the texel loops don't read from ROM. IWRAM is tight (see the
+// Makefile), so there's one slot.
+//
+// Each texture's mips are built from it after unpacking, averaging each 2x2
+// block of texels into the closest color of the palette, so initLighting has
+// to be called first. The smallest ones, which far walls draw from, stay in
+// IWRAM for good.
+
+// IWRAM copy of the hottest texture, up to this many bytes
+#define TEXCACHE_SLOT_SIZE 2048
+// IWRAM for mips, filled smallest first, bytes
+#define TEXCACHE_MIP_IWRAM_SIZE 512
+
+// A grit bitmap holding one or more textures
+typedef struct {
+    const void * data;
+    u32 size;           // bytes, unpacked
+    int compressed;     // LZ77, starting with the BIOS header word
+} TextureSheet;
+
+// texels drawn from each texture this frame, filled in by the renderer
+extern u32 textureUse[NUM_TEXTURES];
+
+// unpack the textures and point textures[] at them, return 0 if they don't fit
+int initTextureCache(void);
+// call after each frame: move the hottest texture into IWRAM if it fits
+void updateTextureCache(void);
+
+#endif
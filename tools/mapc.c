@@ -0,0 +1,494 @@
+// Map compiler: text map source to the binary format in source/map.h,
+// including the potentially visible set of each sector
+// usage: mapc <in.map> <out>
+// The output format follows its extension: .bin is the raw map, .c and .h
+// declare it as a byte array named after the file (like devkitARM's bin2o),
+// for builds that don't use bin2o.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include "map.h"
+#include "render.h"
+
+static fixed vertexX[MAX_VERTICES], vertexY[MAX_VERTICES];
+static Sector sectors[MAX_SECTORS];
+static u16 wallVertex[MAX_WALLS];
+static s16 wallPortal[MAX_WALLS];
+static u16 wallFillNum[MAX_WALLS];
+static u8 wallFillType[MAX_WALLS];
+static int numVertices, numWalls, numSectors;
+
+static const char * inName;
+static int lineNum;
+
+static void error(const char * format, ...) {
+    va_list args;
+    va_start(args, format);
+    if (lineNum)
+        fprintf(stderr, "%s:%d: ", inName, lineNum);
+    else
+        fprintf(stderr, "%s: ", inName);
+    vfprintf(stderr, format, args);
+    fputc('\n', stderr);
+    va_end(args);
+    exit(1);
+}
+
+static const char * nextToken(void) {
+    return strtok(NULL, " \t\r\n");
+}
+
+static const char * needToken(const char * what) {
+    const char * token = nextToken();
+    if (!token)
+        error("expected %s", what);
+    return token;
+}
+
+static long parseInt(const char * what, long min, long max) {
+    const char * token = needToken(what);
+    char * end;
+    long value = strtol(token, &end, 0);
+    if (*end || value < min || value > max)
+        error("bad %s '%s'", what, token);
+    return value;
+}
+
+static fixed parseFixed(const char * what) {
+    const char * token = needToken(what);
+    char * end;
+    double value = strtod(token, &end);
+    if (*end || fabs(value) >= 0x7FFFFF)
+        error("bad %s '%s'", what, token);
+    return (fixed)lround(value * FUNIT);
+}
+
+// solid <color> or texture <num>, a texture the renderer has
+static void parseFill(const char * what, u8 * type, u16 * num) {
+    const char * fill = needToken(what);
+    if (!strcmp(fill, "solid")) {
+        *type = FILL_SOLID;
+        *num = parseInt("color", 0, 0xFFFF);
+    } else if (!strcmp(fill, "texture")) {
+        *type = FILL_TEXTURE;
+        *num = parseInt("texture number", 0, NUM_TEXTURES - 1);
+    } else {
+        error("unknown fill type '%s'", fill);
+    }
+}
+
+static void parseLine(char * line) {
+    char * comment = strchr(line, '#');
+    if (comment)
+        *comment = 0;
+    const char * command = strtok(line, " \t\r\n");
+    if (!command)
+        return;
+
+    if (!strcmp(command, "v")) {
+        if (numVertices == MAX_VERTICES)
+            error("too many vertices (max %d)", MAX_VERTICES);
+        vertexX[numVertices] = parseFixed("x");
+        vertexY[numVertices] = parseFixed("y");
+        numVertices++;
+    } else if (!strcmp(command, "s")) {
+        if (numSectors == MAX_SECTORS)
+            error("too many sectors (max %d)", MAX_SECTORS);
+        Sector * sector = sectors + numSectors++;
+        sector->zmin = parseFixed("zmin");
+        sector->zmax = parseFixed("zmax");
+        parseFill("floor fill", &sector->floorFillType, &sector->floorFillNum);
+        parseFill("ceiling fill", &sector->ceilFillType, &sector->ceilFillNum);
+        sector->light = MAX_LIGHT;
+        const char * option = nextToken();
+        if (option) {
+            if (strcmp(option, "light"))
+                error("unexpected '%s'", option);
+            sector->light = parseInt("light level", 0, MAX_LIGHT);
+        }
+        if (nextToken())
+            error("trailing text after sector");
+        sector->firstWall = numWalls;
+        sector->numWalls = 0;
+        if (sector->zmax <= sector->zmin)
+            error("sector zmax must be above zmin");
+    } else if (!strcmp(command, "w")) {
+        if (!numSectors)
+            error("wall before first sector");
+        if (numWalls == MAX_WALLS)
+            error("too many walls (max %d)", MAX_WALLS);
+        wallVertex[numWalls] = parseInt("vertex", 0, numVertices - 1);
+        parseFill("fill type", wallFillType + numWalls, wallFillNum + numWalls);
+        wallPortal[numWalls] = NO_PORTAL;
+        const char * option = nextToken();
+        if (option) {
+            if (strcmp(option, "portal"))
+                error("unexpected '%s'", option);
+            // checked once all sectors are known
+            wallPortal[numWalls] = parseInt("portal sector", 0, MAX_SECTORS - 1);
+        }
+        if (nextToken())
+            error("trailing text after wall");
+        numWalls++;
+        sectors[numSectors - 1].numWalls++;
+    } else {
+        error("unknown command '%s'", command);
+    }
+}
+
+// vertex a wall starts from, the end vertex of the sector's wall before it
+static int wallStart(int sector, int wall) {
+    const Sector * sec = sectors + sector;
+    return wallVertex[wall == sec->firstWall ? wall + sec->numWalls - 1 : wall - 1];
+}
+
+// The renderer, the PVS and collision all take sectors to be convex with
+// their walls counterclockwise, and portals to be seen from both sides.
+static void checkSector(int s) {
+    const Sector * sec = sectors + s;
+    if (sec->numWalls < 3)
+        error("sector %d has fewer than 3 walls", s);
+    double turning = 0;
+    for (int w = sec->firstWall; w < sec->firstWall + sec->numWalls; w++) {
+        int next = w + 1 < sec->firstWall + sec->numWalls ? w + 1 : sec->firstWall;
+        int a = wallStart(s, w), b = wallVertex[w], c = wallVertex[next];
+        s64 ex = vertexX[b] - vertexX[a], ey = vertexY[b] - vertexY[a];
+        s64 fx = vertexX[c] - vertexX[b], fy = vertexY[c] - vertexY[b];
+        if (!ex && !ey)
+            error("sector %d: wall %d has no length", s, w);
+        // every corner turns left, by less than half a turn
+        if (ex * fy - ey * fx <= 0)
+            error("sector %d: not convex or not counterclockwise at vertex %d", s, b);
+        turning += atan2((double)(ex * fy - ey * fx), (double)(ex * fx + ey * fy));
+    }
+    // and the walls go round once
+    if (turning > 3 * M_PI)
+        error("sector %d: walls wind around more than once", s);
+}
+
+// a portal needs a wall in the sector it leads to going back the other way
+static void checkPortal(int s, int w) {
+    int next = wallPortal[w];
+    if (next >= numSectors)
+        error("wall %d: portal to missing sector %d", w, next);
+    const Sector * sec = sectors + next;
+    for (int b = sec->firstWall; b < sec->firstWall + sec->numWalls; b++) {
+        if (wallPortal[b] == s && wallVertex[b] == wallStart(s, w)
+                && wallStart(next, b) == wallVertex[w])
+            return;
+    }
+    error("wall %d: sector %d has no portal back to sector %d along it", w, next, s);
+}
+
+static void validate(void) {
+    lineNum = 0;
+    if (!numSectors)
+        error("no sectors");
+    for (int s = 0; s < numSectors; s++)
+        checkSector(s);
+    for (int s = 0; s < numSectors; s++) {
+        for (int w = sectors[s].firstWall; w < sectors[s].firstWall + sectors[s].numWalls; w++) {
+            if (wallPortal[w] != NO_PORTAL)
+                checkPortal(s, w);
+        }
+    }
+}
+
+// Potentially visible sets. A sector is visible from another if some line
+// passes from one of the first sector's portals through a chain of portals
+// into it. The lines through a source portal and the last portal passed are
+// bounded by the two separating lines joining their opposite ends, so each
+// next portal is clipped to those and the search goes on through what is
+// left. This is conservative: the source portal is never narrowed.
+//
+// Different chains reach the same portal through different parts of it. What
+// can be seen through part of a portal can also be seen through any wider
+// part, so each portal remembers the widest part already flowed through from
+// the current source, and narrower ones are skipped. The steps per source
+// portal are bounded as well; past PVS_MAX_STEPS the sector gives up and sees
+// every sector connected to it.
+
+typedef struct {
+    double x1, y1, x2, y2;
+} Segment;
+
+static u8 pvs[MAX_SECTORS][PVS_BYTES(MAX_SECTORS)];
+static u8 onPath[MAX_SECTORS];
+// part of each portal flowed through from the current source, as fractions
+// along the wall, if passSeen
+static double passStart[MAX_WALLS], passEnd[MAX_WALLS];
+static u8 passSeen[MAX_WALLS];
+static long pvsSteps;
+
+#define PVS_EPSILON 1e-6
+#define PVS_MAX_STEPS 1000000
+
+static Segment wallSegment(int wall) {
+    int s = 0;
+    while (wall >= sectors[s].firstWall + sectors[s].numWalls)
+        s++;
+    int prev = wall == sectors[s].firstWall ? wall + sectors[s].numWalls - 1 : wall - 1;
+    Segment seg = {
+        vertexX[wallVertex[prev]] / (double)FUNIT, vertexY[wallVertex[prev]] / (double)FUNIT,
+        vertexX[wallVertex[wall]] / (double)FUNIT, vertexY[wallVertex[wall]] / (double)FUNIT
+    };
+    return seg;
+}
+
+// > 0 if (x, y) is left of the line from (ax, ay) to (bx, by)
+static double side(double ax, double ay, double bx, double by, double x, double y) {
+    return (bx - ax) * (y - ay) - (by - ay) * (x - ax);
+}
+
+// clip seg to the side of the line a-b that (x, y) is on
+// return 0 if nothing is left
+static int clipSegment(Segment * seg, double ax, double ay, double bx, double by,
+        double x, double y) {
+    double ref = side(ax, ay, bx, by, x, y);
+    if (fabs(ref) < PVS_EPSILON)
+        return 1; // degenerate, keep it all
+    double d1 = side(ax, ay, bx, by, seg->x1, seg->y1) * ref;
+    double d2 = side(ax, ay, bx, by, seg->x2, seg->y2) * ref;
+    if (d1 < -PVS_EPSILON && d2 < -PVS_EPSILON)
+        return 0;
+    if (d1 < -PVS_EPSILON || d2 < -PVS_EPSILON) {
+        double t = d1 / (d1 - d2);
+        double x = seg->x1 + (seg->x2 - seg->x1) * t, y = seg->y1 + (seg->y2 - seg->y1) * t;
+        if (d1 < 0) {
+            seg->x1 = x;
+            seg->y1 = y;
+        } else {
+            seg->x2 = x;
+            seg->y2 = y;
+        }
+    }
+    return 1;
+}
+
+// Clip seg to the lines which pass through both source and pass. Both are
+// oriented with the space beyond them on their left, so their first ends are
+// on the same side. The separating lines join opposite ends and cross
+// between the two.
+static int clipToSeparators(Segment * seg, const Segment * source, const Segment * pass) {
+    return clipSegment(seg, source->x1, source->y1, pass->x2, pass->y2, pass->x1, pass->y1)
+        && clipSegment(seg, source->x2, source->y2, pass->x1, pass->y1, pass->x2, pass->y2);
+}
+
+// Record the part of wall w that seg covers. Return 0 if it was already
+// flowed through.
+static int widerPass(int w, const Segment * wall, const Segment * seg) {
+    double dx = wall->x2 - wall->x1, dy = wall->y2 - wall->y1;
+    double length2 = dx * dx + dy * dy;
+    double t1 = ((seg->x1 - wall->x1) * dx + (seg->y1 - wall->y1) * dy) / length2;
+    double t2 = ((seg->x2 - wall->x1) * dx + (seg->y2 - wall->y1) * dy) / length2;
+    if (t1 > t2) {
+        double t = t1;
+        t1 = t2;
+        t2 = t;
+    }
+    if (passSeen[w]) {
+        if (t1 >= passStart[w] - PVS_EPSILON && t2 <= passEnd[w] + PVS_EPSILON)
+            return 0;
+        // lines through either part are covered by their union if they touch
+        if (t1 <= passEnd[w] && t2 >= passStart[w]) {
+            t1 = t1 < passStart[w] ? t1 : passStart[w];
+            t2 = t2 > passEnd[w] ? t2 : passEnd[w];
+        } else if (t2 - t1 < passEnd[w] - passStart[w]) {
+            return 1; // keep the wider one
+        }
+    }
+    passSeen[w] = 1;
+    passStart[w] = t1;
+    passEnd[w] = t2;
+    return 1;
+}
+
+// mark sector (entered through pass) and what can be seen beyond it
+static void flowPVS(u8 * visible, const Segment * source, const Segment * pass, int sector) {
+    visible[sector / 8] |= 1 << (sector % 8);
+    onPath[sector] = 1;
+    const Sector * sec = sectors + sector;
+    for (int w = sec->firstWall; w < sec->firstWall + sec->numWalls; w++) {
+        int next = wallPortal[w];
+        if (next == NO_PORTAL || onPath[next])
+            continue;
+        // walls run counterclockwise, so a sector's inside is on their left:
+        // reverse the portal to put the next sector on its left
+        Segment wall = wallSegment(w), seg = {wall.x2, wall.y2, wall.x1, wall.y1};
+        // must be beyond the source portal
+        if (!clipSegment(&seg, source->x1, source->y1, source->x2, source->y2,
+                (source->x1 + source->x2) / 2 - (source->y2 - source->y1),
+                (source->y1 + source->y2) / 2 + (source->x2 - source->x1)))
+            continue;
+        if (pass != source && !clipToSeparators(&seg, source, pass))
+            continue;
+        if (fabs(seg.x1 - seg.x2) + fabs(seg.y1 - seg.y2) < PVS_EPSILON)
+            continue;
+        if (!widerPass(w, &wall, &seg))
+            continue;
+        if (++pvsSteps > PVS_MAX_STEPS)
+            break;
+        flowPVS(visible, source, &seg, next);
+    }
+    onPath[sector] = 0;
+}
+
+// mark every sector reachable through portals
+static void floodPVS(u8 * visible, int sector) {
+    visible[sector / 8] |= 1 << (sector % 8);
+    const Sector * sec = sectors + sector;
+    for (int w = sec->firstWall; w < sec->firstWall + sec->numWalls; w++) {
+        int next = wallPortal[w];
+        if (next != NO_PORTAL && !(visible[next / 8] & (1 << (next % 8))))
+            floodPVS(visible, next);
+    }
+}
+
+static void buildPVS(void) {
+    for (int s = 0; s < numSectors; s++) {
+        pvs[s][s / 8] |= 1 << (s % 8);
+        onPath[s] = 1;
+        const Sector * sec = sectors + s;
+        for (int w = sec->firstWall; w < sec->firstWall + sec->numWalls; w++) {
+            if (wallPortal[w] == NO_PORTAL)
+                continue;
+            // reversed to put the next sector on its left, as in flowPVS
+            Segment seg = wallSegment(w), source = {seg.x2, seg.y2, seg.x1, seg.y1};
+            memset(passSeen, 0, sizeof(passSeen));
+            pvsSteps = 0;
+            flowPVS(pvs[s], &source, &source, wallPortal[w]);
+            if (pvsSteps > PVS_MAX_STEPS) {
+                fprintf(stderr, "%s: sector %d: PVS too slow to work out, it sees "
+                    "everything connected to it\n", inName, s);
+                floodPVS(pvs[s], s);
+                break;
+            }
+        }
+        onPath[s] = 0;
+    }
+}
+
+// zero bytes are coded as 0 and a run length
+static u32 encodePVS(const u8 * bits, u8 * out) {
+    u32 size = 0;
+    int bytes = PVS_BYTES(numSectors);
+    for (int i = 0; i < bytes; i++) {
+        out[size++] = bits[i];
+        if (bits[i] == 0) {
+            int run = 1;
+            while (i + run < bytes && bits[i + run] == 0)
+                run++;
+            out[size++] = run;
+            i += run - 1;
+        }
+    }
+    return size;
+}
+
+static u8 blob[sizeof(MapHeader) + MAX_VERTICES * 8 + MAX_SECTORS * sizeof(Sector)
+    + MAX_WALLS * 8 + MAX_SECTORS * (2 + 2 * PVS_BYTES(MAX_SECTORS)) + 64];
+static u32 blobSize;
+
+// append an array, 4-byte aligned, and return its offset
+static u32 append(const void * data, u32 size) {
+    blobSize = (blobSize + 3) & ~3;
+    u32 offset = blobSize;
+    memcpy(blob + offset, data, size);
+    blobSize += size;
+    return offset;
+}
+
+static void build(void) {
+    MapHeader header = {0};
+    header.magic = MAP_MAGIC;
+    header.version = MAP_VERSION;
+    header.numVertices = numVertices;
+    header.numWalls = numWalls;
+    header.numSectors = numSectors;
+    blobSize = sizeof(header);
+    header.vertexX = append(vertexX, numVertices * sizeof(fixed));
+    header.vertexY = append(vertexY, numVertices * sizeof(fixed));
+    header.sectors = append(sectors, numSectors * sizeof(Sector));
+    header.wallVertex = append(wallVertex, numWalls * sizeof(u16));
+    header.wallPortal = append(wallPortal, numWalls * sizeof(s16));
+    header.wallFillNum = append(wallFillNum, numWalls * sizeof(u16));
+    header.wallFillType = append(wallFillType, numWalls * sizeof(u8));
+
+    buildPVS();
+    static u16 pvsIndex[MAX_SECTORS];
+    static u8 pvsData[MAX_SECTORS * 2 * PVS_BYTES(MAX_SECTORS)];
+    u32 pvsSize = 0;
+    for (int s = 0; s < numSectors; s++) {
+        pvsIndex[s] = pvsSize;
+        pvsSize += encodePVS(pvs[s], pvsData + pvsSize);
+    }
+    header.pvsIndex = append(pvsIndex, numSectors * sizeof(u16));
+    header.pvsData = append(pvsData, pvsSize);
+    blobSize = (blobSize + 3) & ~3;
+    memcpy(blob, &header, sizeof(header));
+}
+
+// output file name without directory or extension
+static void symbolName(const char * path, char * out, int size) {
+    const char * base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    snprintf(out, size, "%s", base);
+    char * ext = strrchr(out, '.');
+    if (ext)
+        *ext = 0;
+}
+
+static void writeOutput(const char * path) {
+    const char * ext = strrchr(path, '.');
+    char symbol[256];
+    symbolName(path, symbol, sizeof(symbol));
+    FILE * file = fopen(path, ext && !strcmp(ext, ".bin") ? "wb" : "w");
+    if (!file) {
+        perror(path);
+        exit(1);
+    }
+    if (ext && !strcmp(ext, ".bin")) {
+        fwrite(blob, 1, blobSize, file);
+    } else if (ext && !strcmp(ext, ".c")) {
+        fprintf(file, "// generated by mapc from %s\n\n", inName);
+        fprintf(file, "const unsigned char %s[%u] __attribute__((aligned(4))) = {", symbol, blobSize);
+        for (u32 i = 0; i < blobSize; i++)
+            fprintf(file, "%s0x%02X,", i % 16 ? " " : "\n\t", blob[i]);
+        fprintf(file, "\n};\n\nconst unsigned int %s_size = %u;\n", symbol, blobSize);
+    } else if (ext && !strcmp(ext, ".h")) {
+        fprintf(file, "// generated by mapc from %s\n\n", inName);
+        fprintf(file, "extern const unsigned char %s[];\n", symbol);
+        fprintf(file, "extern const unsigned int %s_size;\n", symbol);
+    } else {
+        fprintf(stderr, "%s: unknown output type\n", path);
+        exit(1);
+    }
+    fclose(file);
+}
+
+int main(int argc, char ** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: mapc <in.map> <out.bin|out.c|out.h>\n");
+        return 1;
+    }
+    inName = argv[1];
+    FILE * file = fopen(inName, "r");
+    if (!file) {
+        perror(inName);
+        return 1;
+    }
+    char line[1024];
+    while (fgets(line, sizeof(line), file)) {
+        lineNum++;
+        parseLine(line);
+    }
+    fclose(file);
+
+    validate();
+    build();
+    writeOutput(argv[2]);
+    return 0;
+}
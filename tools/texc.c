@@ -0,0 +1,111 @@
+// Texture packer: the grit texture sheet in gfx/ LZ77 compressed in the BIOS
+// format (what grit -gzl makes), and its palette as is
+// usage: texc <out.c|out.h>
+// The output declares texturesLz, the compressed bitmap, and texturesPal. It
+// is checked by unpacking it again with the host LZ77UnCompWram.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "platform.h"
+#include "textures.h"
+
+// header word and a flag byte per 8 blocks, at worst all literals
+static u8 packed[4 + texturesBitmapLen * 9 / 8 + 1] __attribute__((aligned(4)));
+static u32 packedSize;
+
+// Compress in the BIOS LZ77 format (see LZ77UnCompWram), taking the longest
+// match in the last 4 KB at each byte.
+static void compress(const u8 * src, int size) {
+    u8 * out = packed;
+    *out++ = 0x10;
+    *out++ = size;
+    *out++ = size >> 8;
+    *out++ = size >> 16;
+    int pos = 0;
+    while (pos < size) {
+        u8 * flags = out++;
+        *flags = 0;
+        for (int i = 0; i < 8 && pos < size; i++) {
+            int bestLength = 0, bestDistance = 0;
+            for (int distance = 1; distance <= 4096 && distance <= pos; distance++) {
+                int length = 0;
+                while (length < 18 && pos + length < size
+                        && src[pos + length] == src[pos + length - distance])
+                    length++;
+                if (length > bestLength) {
+                    bestLength = length;
+                    bestDistance = distance;
+                }
+            }
+            if (bestLength >= 3) {
+                *flags |= 0x80 >> i;
+                *out++ = ((bestLength - 3) << 4) | ((bestDistance - 1) >> 8);
+                *out++ = bestDistance - 1;
+                pos += bestLength;
+            } else {
+                *out++ = src[pos++];
+            }
+        }
+    }
+    packedSize = out - packed;
+}
+
+// unpack into a buffer with a guard after it, to catch overruns too
+static int check(void) {
+    static u8 unpacked[texturesBitmapLen + 32] __attribute__((aligned(4)));
+    memset(unpacked, 0xA5, sizeof(unpacked));
+    LZ77UnCompWram(packed, unpacked);
+    if (memcmp(unpacked, texturesBitmap, texturesBitmapLen))
+        return 0;
+    for (int i = texturesBitmapLen; i < sizeof(unpacked); i++) {
+        if (unpacked[i] != 0xA5)
+            return 0;
+    }
+    return 1;
+}
+
+static void writeOutput(const char * path) {
+    const char * ext = strrchr(path, '.');
+    FILE * file = fopen(path, "w");
+    if (!file) {
+        perror(path);
+        exit(1);
+    }
+    if (ext && !strcmp(ext, ".c")) {
+        fprintf(file, "// generated by texc from gfx/textures.c\n\n");
+        fprintf(file, "const unsigned char texturesLz[%u] __attribute__((aligned(4))) = {", packedSize);
+        for (u32 i = 0; i < packedSize; i++)
+            fprintf(file, "%s0x%02X,", i % 16 ? " " : "\n\t", packed[i]);
+        fprintf(file, "\n};\n\nconst unsigned short texturesPal[%d] __attribute__((aligned(4))) = {",
+            texturesPalLen / 2);
+        for (int i = 0; i < texturesPalLen / 2; i++)
+            fprintf(file, "%s0x%04X,", i % 8 ? " " : "\n\t", texturesPal[i]);
+        fprintf(file, "\n};\n");
+    } else if (ext && !strcmp(ext, ".h")) {
+        fprintf(file, "// generated by texc from gfx/textures.c\n\n");
+        fprintf(file, "// bytes, unpacked\n#define texturesBitmapLen %d\n", texturesBitmapLen);
+        fprintf(file, "#define texturesLzLen %u\n", packedSize);
+        fprintf(file, "extern const unsigned char texturesLz[%u];\n\n", packedSize);
+        fprintf(file, "#define texturesPalLen %d\n", texturesPalLen);
+        fprintf(file, "extern const unsigned short texturesPal[%d];\n", texturesPalLen / 2);
+    } else {
+        fprintf(stderr, "%s: unknown output type\n", path);
+        exit(1);
+    }
+    fclose(file);
+}
+
+int main(int argc, char ** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: texc <out.c|out.h>\n");
+        return 1;
+    }
+    compress((const u8 *)texturesBitmap, texturesBitmapLen);
+    if (!check()) {
+        fprintf(stderr, "texc: LZ77 round trip failed\n");
+        return 1;
+    }
+    writeOutput(argv[1]);
+    return 0;
+}